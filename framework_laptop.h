@@ -12,39 +12,395 @@
 
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/hrtimer.h>
+#include <linux/kref.h>
 #include <linux/leds.h>
+#include <linux/led-class-multicolor.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/perf_event.h>
 #include <linux/platform_device.h>
+#include <linux/platform_profile.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include <acpi/battery.h>
 
 #define DRV_NAME "framework_laptop"
 #define FRAMEWORK_LAPTOP_EC_DEVICE_NAME "cros-ec-dev"
 
-struct framework_led {
-	enum ec_led_id id;
-	enum ec_led_colors color;
-	struct led_classdev led;
-	struct framework_led *others;
+#define FW_TEMP_SENSOR_ENTRIES \
+	(EC_TEMP_SENSOR_ENTRIES + EC_TEMP_SENSOR_B_ENTRIES)
+
+/* Temperature sensors, fans and battery all live below the battery strings */
+#define FW_MEMMAP_SNAPSHOT_SIZE EC_MEMMAP_BATT_MFGR
+
+struct fw_memmap_cache {
+	struct mutex lock;
+	unsigned long timestamp;
+	bool valid;
+	/* raw is the last good snapshot, even if it's no longer valid */
+	bool good;
+	u8 raw[FW_MEMMAP_SNAPSHOT_SIZE];
+	u64 hits;
+	u64 misses;
+	/* Background refresh for reads with a deadline */
+	struct work_struct refresh_work;
+	wait_queue_head_t wait;
+	unsigned long attempts;
+	unsigned long updates;
+	u8 next[FW_MEMMAP_SNAPSHOT_SIZE];
+};
+
+/* Per-command EC statistics, latencies are bucketed by log2 of microseconds */
+#define FW_EC_STATS_COMMANDS 16
+#define FW_EC_LATENCY_BUCKETS 24
+#define FW_EC_CMD_READMEM -1
+
+struct fw_ec_cmd_stats {
+	int command;
+	unsigned int version;
+	u64 calls;
+	u64 errors;
+	u64 total_ns;
+	u64 min_ns;
+	u64 max_ns;
+	u64 buckets[FW_EC_LATENCY_BUCKETS];
+};
+
+struct fw_ec_stats {
+	spinlock_t lock;
+	struct fw_ec_cmd_stats cmds[FW_EC_STATS_COMMANDS];
+};
+
+/* Read-only EC commands currently in flight, see fw_ec_cmd_shared() */
+struct fw_ec_singleflight {
+	spinlock_t lock;
+	struct list_head list;
+	/* Transactions sent, and callers that shared one instead */
+	u64 issued;
+	u64 shared;
+};
+
+/* Last good responses to read-only commands, see read_deadline_ms */
+#define FW_EC_LAST_GOOD_ENTRIES 16
+#define FW_EC_LAST_GOOD_SIZE 32
+
+struct fw_ec_last_good {
+	int command;
+	unsigned int version;
+	size_t outsize;
+	size_t insize;
+	unsigned long timestamp;
+	/* The request, followed by the response */
+	u8 buf[FW_EC_LAST_GOOD_SIZE];
+};
+
+struct fw_ec_health {
+	spinlock_t lock;
+	unsigned int failures;
+	unsigned int backoff_ms;
+	unsigned long retry_at;
+	u64 backoffs;
+	u64 stale;
+	struct fw_ec_last_good last_good[FW_EC_LAST_GOOD_ENTRIES];
+};
+
+/* EC command scheduler classes, in priority order */
+enum fw_ec_prio {
+	FW_EC_PRIO_INTERACTIVE,
+	FW_EC_PRIO_BACKGROUND,
+	FW_EC_PRIO_COUNT,
+};
+
+struct fw_ec_sched_class {
+	struct list_head waiters;
+	unsigned int depth;
+	unsigned int max_depth;
+	/* Commands sent, and how many of them had to wait */
+	u64 requests;
+	u64 queued;
+	u64 wait_ns;
+	u64 max_wait_ns;
+};
+
+struct fw_ec_sched {
+	spinlock_t lock;
+	bool busy;
+	struct fw_ec_sched_class classes[FW_EC_PRIO_COUNT];
+};
+
+/* pwmN_enable modes */
+enum fw_fan_mode {
+	FW_FAN_MODE_MANUAL = 1,
+	FW_FAN_MODE_EC_AUTO = 2,
+	FW_FAN_MODE_CURVE = 3,
+};
+
+#define FW_FAN_CURVE_POINTS 5
+/* Temperature and duty cycle for every point, plus hysteresis */
+#define FW_FAN_CURVE_ATTRS (FW_FAN_CURVE_POINTS * 2 + 1)
+#define FW_FAN_CURVE_MAX_TEMP 150000
+
+struct fw_fan_curve {
+	enum fw_fan_mode mode;
+	unsigned long channels;
+	long temp[FW_FAN_CURVE_POINTS];
+	long pwm[FW_FAN_CURVE_POINTS];
+	long hyst;
+	/* Last duty cycle sent to the EC, -1 if unknown */
+	long duty;
+	/* Last manual fanN_target, -1 if unknown */
+	long rpm;
+	long duty_temp;
+};
+
+struct fw_fan_cooling {
+	struct framework_data *data;
+	struct thermal_cooling_device *cdev;
+	u8 idx;
+	unsigned long state;
+};
+
+/* Fan and indicator LED writes waiting to be sent, see setpoint_ms */
+enum fw_setpoint_kind {
+	FW_SETPOINT_FAN_DUTY,
+	FW_SETPOINT_FAN_RPM,
+};
+
+struct fw_setpoints {
+	spinlock_t lock;
+	unsigned long pending;
+	u8 fan_kind[EC_FAN_SPEED_ENTRIES];
+	u32 fan_value[EC_FAN_SPEED_ENTRIES];
+	u8 led[EC_LED_COLOR_COUNT];
+	unsigned long last;
+	struct delayed_work work;
+	/* Writes replaced before they were sent, and writes sent */
+	u64 merged;
+	u64 sent;
+};
+
+/* What an EC event may have changed */
+#define FW_CHANGED_THERMAL BIT(0)
+#define FW_CHANGED_BATTERY BIT(1)
+#define FW_CHANGED_KB_LED BIT(2)
+#define FW_CHANGED_SWITCHES BIT(3)
+
+/* Telemetry sampler feeding the ring mapped by /dev/framework_laptop */
+struct fw_telemetry {
+	struct mutex lock;
+	struct fw_telemetry_ring *ring;
+	struct fw_telemetry_record *records;
+	size_t size;
+	/* Kernel copies, userspace may scribble over the mapped ones */
+	u64 head;
+	u64 dropped;
+	u32 watermark;
+	ktime_t period;
+	struct hrtimer timer;
+	struct work_struct work;
+	wait_queue_head_t wait;
+	struct file *owner;
+};
+
+/* /dev/framework_laptop, lives on after unbind until the last file closes */
+struct fw_cdev {
+	struct kref ref;
+	struct miscdevice misc;
+	/* NULL once the device is gone, set under telemetry.lock */
+	struct framework_data *data;
+	struct fw_telemetry telemetry;
+};
+
+/* Battery discharge energy, integrated for the powercap zone */
+struct fw_energy {
+	spinlock_t lock;
+	u64 energy_uj;
+	/* Below a microjoule, in femtojoules */
+	u64 remainder;
+	u64 last_uw;
+	ktime_t last;
+	struct delayed_work work;
+	struct powercap_control_type *control_type;
+	struct powercap_zone *zone;
+};
+
+/* perf PMU, reads come from the last sample since they can't sleep */
+struct fw_pmu {
+	struct pmu pmu;
+	raw_spinlock_t lock;
+	u8 raw[FW_MEMMAP_SNAPSHOT_SIZE];
+	u64 energy_uj;
+	atomic_t active;
+	struct delayed_work work;
+	bool registered;
+	struct attribute **events;
+	struct attribute_group events_group;
+	const struct attribute_group *groups[4];
+};
+
+/* Extra attributes on the ACPI battery, var in each one points back here */
+#define FW_BATTERY_ATTRS 5
+
+struct fw_battery {
+	struct acpi_battery_hook hook;
+	struct dev_ext_attribute attrs[FW_BATTERY_ATTRS];
+	struct attribute *attr_list[FW_BATTERY_ATTRS + 1];
+	struct attribute_group group;
+	const struct attribute_group *groups[2];
+};
+
+/* Everything registered on top of the EC, see fw_probe_stages */
+enum fw_probe_stage_id {
+	FW_PROBE_BATTERY,
+	FW_PROBE_LEDS,
+	FW_PROBE_COLOR_LEDS,
+	FW_PROBE_HWMON,
+	FW_PROBE_PRIVACY,
+	FW_PROBE_ENERGY,
+	FW_PROBE_PMU,
+	FW_PROBE_METRICS,
+	FW_PROBE_CDEV,
+	FW_PROBE_PROFILE,
+	FW_PROBE_EVENTS,
+	FW_PROBE_COUNT,
 };
 
 struct framework_data {
 	struct platform_device *pdev;
 	struct device *ec_device;
+	u64 probe_us;
+	/* Bits of enum fw_probe_stage_id that registered */
+	unsigned long probed;
 	struct device *hwmon_dev;
+	size_t fan_count;
+	unsigned long temp_present;
+	const char *temp_labels[FW_TEMP_SENSOR_ENTRIES];
+	struct mutex fan_lock;
+	struct fw_fan_curve fan_curve[EC_FAN_SPEED_ENTRIES];
+	struct delayed_work fan_curve_work;
+	struct attribute_group fan_curve_group;
+	struct fw_fan_cooling fan_cooling[EC_FAN_SPEED_ENTRIES];
+	struct fw_setpoints setpoints;
+	const struct attribute_group *hwmon_groups[3];
+	struct input_dev *privacy_input;
+	int privacy_state;
+	struct delayed_work privacy_poll_work;
+	struct notifier_block event_notifier;
+	struct work_struct event_work;
+	atomic_long_t event_changed;
+	struct dentry *debugfs;
+	struct fw_memmap_cache memmap;
+	struct fw_ec_stats ec_stats;
+	struct fw_ec_singleflight ec_flights;
+	struct fw_ec_sched ec_sched;
+	struct fw_ec_health ec_health;
+	struct workqueue_struct *ec_wq;
+	struct fw_cdev *cdev;
+	struct fw_energy energy;
+	struct fw_pmu pmu;
+	struct fw_battery battery;
+	enum platform_profile_option profile;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+	struct device *profile_dev;
+#else
+	struct platform_profile_handler profile_handler;
+	bool profile_registered;
+#endif
 	struct led_classdev kb_led;
+	struct mutex kb_lock;
+	int kb_brightness;
+	struct delayed_work kb_poll_work;
 	struct led_classdev fp_led;
-	struct framework_led batt_led[EC_LED_COLOR_COUNT];
+	struct led_classdev_mc batt_led;
+	struct mc_subled batt_subleds[EC_LED_COLOR_COUNT];
+	u8 batt_led_range[EC_LED_COLOR_COUNT];
+	bool batt_trigger_registered;
 };
 
+int fw_ec_register(struct framework_data *data);
+void fw_ec_unregister(struct framework_data *data);
+int fw_ec_cmd(struct framework_data *data, unsigned int version, int command,
+	      const void *outdata, size_t outsize, void *indata,
+	      size_t insize);
+int fw_ec_cmd_shared(struct framework_data *data, unsigned int version,
+		     int command, const void *outdata, size_t outsize,
+		     void *indata, size_t insize);
+int fw_ec_cmd_shared_prio(struct framework_data *data, enum fw_ec_prio prio,
+			  unsigned int version, int command,
+			  const void *outdata, size_t outsize, void *indata,
+			  size_t insize);
+int fw_ec_readmem(struct framework_data *data, unsigned int offset,
+		  unsigned int bytes, void *dest);
+int fw_ec_memmap_snapshot(struct framework_data *data, u8 *raw);
+void fw_ec_memmap_invalidate(struct framework_data *data);
+
+int fw_events_register(struct framework_data *data);
+void fw_events_unregister(struct framework_data *data);
+bool fw_events_supported(struct framework_data *data);
+
 int fw_hwmon_register(struct framework_data *data);
 void fw_hwmon_unregister(struct framework_data *data);
+int fw_fan_set_duty(struct framework_data *data, u8 idx, u32 percent);
+int fw_fan_set_rpm(struct framework_data *data, u8 idx, u32 rpm);
+int fw_fan_set_mode(struct framework_data *data, u8 idx, long mode);
+long fw_memmap_fan_rpm(const u8 *raw, u8 idx);
+int fw_memmap_temp(const u8 *raw, u8 idx, long *val);
+int fw_fan_get_target(struct framework_data *data, u32 *rpm);
+int fw_intrusion_get(struct framework_data *data, int channel, long *val);
 
 int fw_color_leds_register(struct framework_data *data);
 void fw_color_leds_unregister(struct framework_data *data);
+int fw_color_led_set(struct framework_data *data, const u8 *brightness);
+int fw_color_led_auto(struct framework_data *data);
 
 int fw_leds_register(struct framework_data *data);
 void fw_leds_unregister(struct framework_data *data);
+void fw_kb_led_refresh(struct framework_data *data);
+int fw_kb_led_get(struct framework_data *data);
+int fw_kb_led_set(struct framework_data *data, unsigned int percent);
+int fw_fp_led_set(struct framework_data *data, unsigned int level);
 
 int fw_battery_register(struct framework_data *data);
 void fw_battery_unregister(struct framework_data *data);
+int fw_battery_set_limit(struct framework_data *data, unsigned int percent);
+int fw_battery_get_limit(struct framework_data *data);
+
+int fw_setpoint_register(struct framework_data *data);
+void fw_setpoint_unregister(struct framework_data *data);
+bool fw_setpoint_fan(struct framework_data *data, u8 idx,
+		     enum fw_setpoint_kind kind, u32 value);
+void fw_setpoint_fan_cancel(struct framework_data *data, u8 idx);
+void fw_setpoint_led_cancel(struct framework_data *data);
+bool fw_setpoint_led(struct framework_data *data, const u8 *brightness);
+
+int fw_energy_register(struct framework_data *data);
+void fw_energy_unregister(struct framework_data *data);
+u64 fw_energy_uj(struct framework_data *data);
+u64 fw_energy_power_uw(const u8 *raw);
+
+int fw_metrics_register(struct framework_data *data);
+
+int fw_pmu_register(struct framework_data *data);
+void fw_pmu_unregister(struct framework_data *data);
+
+int fw_profile_register(struct framework_data *data);
+void fw_profile_unregister(struct framework_data *data);
+
+struct fw_batch_op;
+int fw_cdev_register(struct framework_data *data);
+void fw_cdev_unregister(struct framework_data *data);
+int fw_batch_apply(struct framework_data *data, struct fw_batch_op *ops,
+		   u32 count);
+
+int fw_privacy_register(struct framework_data *data);
+void fw_privacy_unregister(struct framework_data *data);
+int fw_privacy_get(struct framework_data *data, bool *microphone, bool *camera);
+void fw_privacy_refresh(struct framework_data *data);
 
 /* SysFS attributes */
 ssize_t framework_privacy_show(struct device *dev,
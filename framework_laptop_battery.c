@@ -26,8 +26,6 @@
 
 #include "framework_laptop.h"
 
-static struct device *ec_device;
-
 #define EC_CMD_CHARGE_LIMIT_CONTROL 0x3E03
 
 enum ec_chg_limit_control_modes {
@@ -53,56 +51,75 @@ struct ec_response_chg_limit_control {
 	uint8_t min_percentage;
 } __ec_align1;
 
-static int charge_limit_control(enum ec_chg_limit_control_modes modes, uint8_t max_percentage) {
-	struct {
-		struct cros_ec_command msg;
-		union {
-			struct ec_params_ec_chg_limit_control params;
-			struct ec_response_chg_limit_control resp;
-		};
-	} __packed buf;
-	struct ec_params_ec_chg_limit_control *params = &buf.params;
-	struct ec_response_chg_limit_control *resp = &buf.resp;
-	struct cros_ec_command *msg = &buf.msg;
-	struct cros_ec_device *ec;
+static int charge_limit_control(struct framework_data *data,
+				enum ec_chg_limit_control_modes modes,
+				uint8_t max_percentage)
+{
+	struct ec_params_ec_chg_limit_control params = {
+		.modes = modes,
+		.max_percentage = max_percentage,
+	};
+	struct ec_response_chg_limit_control resp;
 	int ret;
 
-	if (!ec_device)
+	if (!data)
 		return -ENODEV;
 
-	ec = dev_get_drvdata(ec_device);
+	/* Concurrent readers can share one transaction */
+	if (modes == CHG_LIMIT_GET_LIMIT)
+		ret = fw_ec_cmd_shared(data, 0, EC_CMD_CHARGE_LIMIT_CONTROL,
+				       &params, sizeof(params), &resp,
+				       sizeof(resp));
+	else
+		ret = fw_ec_cmd(data, 0, EC_CMD_CHARGE_LIMIT_CONTROL, &params,
+				sizeof(params), &resp, sizeof(resp));
+	if (ret < 0) {
+		return -EIO;
+	}
 
-	memset(&buf, 0, sizeof(buf));
+	return resp.max_percentage;
+}
 
-	msg->version = 0;
-	msg->command = EC_CMD_CHARGE_LIMIT_CONTROL;
-	msg->outsize = sizeof(*params);
-	msg->insize = sizeof(*resp);
+/* Set the maximum charge percentage */
+int fw_battery_set_limit(struct framework_data *data, unsigned int percent)
+{
+	int ret;
 
-	params->modes = modes;
-	params->max_percentage = max_percentage;
+	if (percent > 100)
+		return -EINVAL;
 
-	ret = cros_ec_cmd_xfer_status(ec, msg);
-	if (ret < 0) {
-		return -EIO;
-	}
+	ret = charge_limit_control(data, CHG_LIMIT_SET_LIMIT, (uint8_t)percent);
+	if (ret < 0)
+		return ret;
 
-	return resp->max_percentage;
+	return 0;
 }
 
+/* Get the maximum charge percentage */
+int fw_battery_get_limit(struct framework_data *data)
+{
+	return charge_limit_control(data, CHG_LIMIT_GET_LIMIT, 0);
+}
 
-static ssize_t battery_get_threshold(char *buf)
+/* The battery's attributes carry the driver data in var */
+static struct framework_data *fw_battery_data(struct device_attribute *attr)
+{
+	return container_of(attr, struct dev_ext_attribute, attr)->var;
+}
+
+static ssize_t battery_get_threshold(struct framework_data *data, char *buf)
 {
 	int ret;
 
-	ret = charge_limit_control(CHG_LIMIT_GET_LIMIT, 0);
+	ret = fw_battery_get_limit(data);
 	if (ret < 0)
 		return ret;
 
 	return sysfs_emit(buf, "%d\n", (int)ret);
 }
 
-static ssize_t battery_set_threshold(const char *buf, size_t count)
+static ssize_t battery_set_threshold(struct framework_data *data,
+				     const char *buf, size_t count)
 {
 	int ret;
 	int value;
@@ -111,10 +128,7 @@ static ssize_t battery_set_threshold(const char *buf, size_t count)
 	if (ret)
 		return ret;
 
-	if (value > 100)
-		return -EINVAL;
-
-	ret = charge_limit_control(CHG_LIMIT_SET_LIMIT, (uint8_t)value);
+	ret = fw_battery_set_limit(data, value);
 	if (ret < 0)
 		return ret;
 
@@ -124,67 +138,197 @@ static ssize_t battery_set_threshold(const char *buf, size_t count)
 static ssize_t charge_control_end_threshold_show(struct device *dev,
 	struct device_attribute *attr, char *buf)
 {
-	return battery_get_threshold(buf);
+	return battery_get_threshold(fw_battery_data(attr), buf);
 }
 
 static ssize_t charge_control_end_threshold_store(struct device *dev,
 	struct device_attribute *attr, const char *buf, size_t count)
 {
-	return battery_set_threshold(buf, count);
+	return battery_set_threshold(fw_battery_data(attr), buf, count);
 }
 
-static DEVICE_ATTR_RW(charge_control_end_threshold);
-
-static struct attribute *framework_laptop_battery_attrs[] = {
-	&dev_attr_charge_control_end_threshold.attr,
-	NULL,
+/**** Battery state from the memory map ****/
+struct fw_battery_now {
+	u32 voltage;	/* mV */
+	u32 rate;	/* mA */
+	u32 capacity;	/* mAh */
+	u8 flags;
 };
 
-ATTRIBUTE_GROUPS(framework_laptop_battery);
+/* A fresh read on every access, skipping ACPI's _BST */
+static int fw_battery_now(struct framework_data *data,
+			  struct fw_battery_now *now)
+{
+	u8 raw[FW_MEMMAP_SNAPSHOT_SIZE];
+	int ret;
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
-static int framework_laptop_battery_add(struct power_supply *battery, struct acpi_battery_hook *hook)
-#else
-static int framework_laptop_battery_add(struct power_supply *battery)
-#endif
+	ret = fw_ec_memmap_snapshot(data, raw);
+	if (ret < 0)
+		return -EIO;
+
+	memcpy(&now->voltage, raw + EC_MEMMAP_BATT_VOLT, sizeof(now->voltage));
+	memcpy(&now->rate, raw + EC_MEMMAP_BATT_RATE, sizeof(now->rate));
+	memcpy(&now->capacity, raw + EC_MEMMAP_BATT_CAP,
+	       sizeof(now->capacity));
+	now->flags = raw[EC_MEMMAP_BATT_FLAG];
+
+	if (!(now->flags & EC_BATT_FLAG_BATT_PRESENT))
+		return -ENODEV;
+
+	return 0;
+}
+
+/* Signed like the power_supply ABI, negative while discharging */
+static s64 fw_battery_current_ua(const struct fw_battery_now *now)
+{
+	s64 current_ua = (s64)now->rate * 1000;
+
+	return now->flags & EC_BATT_FLAG_DISCHARGING ? -current_ua :
+							 current_ua;
+}
+
+static ssize_t voltage_now_fast_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct fw_battery_now now;
+	int ret;
+
+	ret = fw_battery_now(fw_battery_data(attr), &now);
+	if (ret < 0)
+		return ret;
+
+	return sysfs_emit(buf, "%llu\n", (u64)now.voltage * 1000);
+}
+
+static ssize_t current_now_fast_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct fw_battery_now now;
+	int ret;
+
+	ret = fw_battery_now(fw_battery_data(attr), &now);
+	if (ret < 0)
+		return ret;
+
+	return sysfs_emit(buf, "%lld\n", fw_battery_current_ua(&now));
+}
+
+static ssize_t power_now_fast_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct fw_battery_now now;
+	int ret;
+
+	ret = fw_battery_now(fw_battery_data(attr), &now);
+	if (ret < 0)
+		return ret;
+
+	/* mV * mA is already uW */
+	return sysfs_emit(buf, "%lld\n",
+			  div_s64(fw_battery_current_ua(&now) * now.voltage,
+				  1000));
+}
+
+static ssize_t charge_now_fast_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct fw_battery_now now;
+	int ret;
+
+	ret = fw_battery_now(fw_battery_data(attr), &now);
+	if (ret < 0)
+		return ret;
+
+	return sysfs_emit(buf, "%llu\n", (u64)now.capacity * 1000);
+}
+
+/* Templates, every device gets its own copy pointing back at it */
+static const struct device_attribute fw_battery_attrs[FW_BATTERY_ATTRS] = {
+	__ATTR_RW(charge_control_end_threshold),
+	__ATTR_RO(voltage_now_fast),
+	__ATTR_RO(current_now_fast),
+	__ATTR_RO(power_now_fast),
+	__ATTR_RO(charge_now_fast),
+};
+
+static int fw_battery_add(struct fw_battery *fb, struct power_supply *battery)
 {
 	// Framework EC only supports 1 battery
 	if (strcmp(battery->desc->name, "BAT1") != 0)
 		return -ENODEV;
 
-	if (device_add_groups(&battery->dev, framework_laptop_battery_groups))
+	if (device_add_groups(&battery->dev, fb->groups))
 		return -ENODEV;
 
 	return 0;
 }
 
+static int fw_battery_remove(struct fw_battery *fb,
+			     struct power_supply *battery)
+{
+	device_remove_groups(&battery->dev, fb->groups);
+	return 0;
+}
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+static int framework_laptop_battery_add(struct power_supply *battery, struct acpi_battery_hook *hook)
+{
+	return fw_battery_add(container_of(hook, struct fw_battery, hook),
+			      battery);
+}
+
 static int framework_laptop_battery_remove(struct power_supply *battery, struct acpi_battery_hook *hook)
-#else
-static int framework_laptop_battery_remove(struct power_supply *battery)
-#endif
 {
-	device_remove_groups(&battery->dev, framework_laptop_battery_groups);
-	return 0;
+	return fw_battery_remove(container_of(hook, struct fw_battery, hook),
+				 battery);
 }
+#else
+/* These kernels don't pass the hook, so only one device can have it */
+static struct fw_battery *fw_battery_compat;
 
-static struct acpi_battery_hook framework_laptop_battery_hook = {
-	.add_battery = framework_laptop_battery_add,
-	.remove_battery = framework_laptop_battery_remove,
-	.name = "Framework Laptop Battery Extension",
-};
+static int framework_laptop_battery_add(struct power_supply *battery)
+{
+	return fw_battery_add(fw_battery_compat, battery);
+}
 
+static int framework_laptop_battery_remove(struct power_supply *battery)
+{
+	return fw_battery_remove(fw_battery_compat, battery);
+}
+#endif
 
 int fw_battery_register(struct framework_data *data)
 {
-	ec_device = data->ec_device;
-	
-	battery_hook_register(&framework_laptop_battery_hook);
-	
+	struct fw_battery *fb = &data->battery;
+
+	for (int i = 0; i < FW_BATTERY_ATTRS; i++) {
+		fb->attrs[i].attr = fw_battery_attrs[i];
+		fb->attrs[i].var = data;
+		sysfs_attr_init(&fb->attrs[i].attr.attr);
+		fb->attr_list[i] = &fb->attrs[i].attr.attr;
+	}
+	fb->group.attrs = fb->attr_list;
+	fb->groups[0] = &fb->group;
+
+	fb->hook.add_battery = framework_laptop_battery_add;
+	fb->hook.remove_battery = framework_laptop_battery_remove;
+	fb->hook.name = "Framework Laptop Battery Extension";
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+	if (fw_battery_compat)
+		return -EBUSY;
+	fw_battery_compat = fb;
+#endif
+
+	battery_hook_register(&fb->hook);
+
 	return 0;
 }
 
 void fw_battery_unregister(struct framework_data *data)
 {
-	battery_hook_unregister(&framework_laptop_battery_hook);
-}
\ No newline at end of file
+	battery_hook_unregister(&data->battery.hook);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+	fw_battery_compat = NULL;
+#endif
+}
@@ -0,0 +1,451 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+#include "framework_laptop_uapi.h"
+
+#define FW_TELEMETRY_RECORDS 4096
+#define FW_TELEMETRY_MAX_HZ 200
+
+/**** Telemetry sampler ****/
+static void fw_telemetry_fill(struct fw_telemetry_record *rec, const u8 *raw)
+{
+	memset(rec, 0, sizeof(*rec));
+
+	rec->timestamp_ns = ktime_get_ns();
+	memcpy(rec->fan_rpm, raw + EC_MEMMAP_FAN, sizeof(rec->fan_rpm));
+	memcpy(rec->temp, raw + EC_MEMMAP_TEMP_SENSOR, EC_TEMP_SENSOR_ENTRIES);
+	memcpy(rec->temp + EC_TEMP_SENSOR_ENTRIES,
+	       raw + EC_MEMMAP_TEMP_SENSOR_B, EC_TEMP_SENSOR_B_ENTRIES);
+	memcpy(&rec->battery_voltage, raw + EC_MEMMAP_BATT_VOLT,
+	       sizeof(rec->battery_voltage));
+	memcpy(&rec->battery_rate, raw + EC_MEMMAP_BATT_RATE,
+	       sizeof(rec->battery_rate));
+	memcpy(&rec->battery_capacity, raw + EC_MEMMAP_BATT_CAP,
+	       sizeof(rec->battery_capacity));
+	rec->battery_flags = raw[EC_MEMMAP_BATT_FLAG];
+}
+
+/* The EC read can sleep, so the timer hands the sample off to here */
+static void fw_telemetry_work(struct work_struct *work)
+{
+	struct fw_telemetry *tel =
+		container_of(work, struct fw_telemetry, work);
+	struct fw_cdev *cdev = container_of(tel, struct fw_cdev, telemetry);
+	struct framework_data *data = cdev->data;
+	struct fw_telemetry_ring *ring = tel->ring;
+	u8 raw[FW_MEMMAP_SNAPSHOT_SIZE];
+	u64 tail;
+
+	if (fw_ec_memmap_snapshot(data, raw) < 0)
+		return;
+
+	/* Userspace owns tail, don't trust it further than this */
+	tail = READ_ONCE(ring->tail);
+	if (tel->head - tail >= FW_TELEMETRY_RECORDS) {
+		WRITE_ONCE(ring->dropped, ++tel->dropped);
+		goto wake;
+	}
+
+	fw_telemetry_fill(&tel->records[tel->head % FW_TELEMETRY_RECORDS],
+			  raw);
+
+	/* Publish the record before the new head */
+	smp_wmb();
+	WRITE_ONCE(ring->head, ++tel->head);
+
+wake:
+	if (tel->head - tail >= tel->watermark)
+		wake_up_interruptible(&tel->wait);
+}
+
+static enum hrtimer_restart fw_telemetry_timer(struct hrtimer *timer)
+{
+	struct fw_telemetry *tel =
+		container_of(timer, struct fw_telemetry, timer);
+
+	queue_work(system_highpri_wq, &tel->work);
+	hrtimer_forward_now(timer, tel->period);
+
+	return HRTIMER_RESTART;
+}
+
+/* Must be called with the telemetry lock held */
+static void fw_telemetry_stop(struct fw_telemetry *tel)
+{
+	if (!tel->owner)
+		return;
+
+	hrtimer_cancel(&tel->timer);
+	cancel_work_sync(&tel->work);
+	tel->owner = NULL;
+}
+
+/* Must be called with the telemetry lock held */
+static int fw_telemetry_start(struct fw_telemetry *tel, struct file *file,
+			      void __user *argp)
+{
+	struct fw_telemetry_config config;
+
+	if (copy_from_user(&config, argp, sizeof(config)))
+		return -EFAULT;
+
+	if (!config.rate_hz || config.rate_hz > FW_TELEMETRY_MAX_HZ ||
+	    !config.watermark || config.watermark > FW_TELEMETRY_RECORDS)
+		return -EINVAL;
+
+	if (tel->owner && tel->owner != file)
+		return -EBUSY;
+
+	fw_telemetry_stop(tel);
+
+	tel->watermark = config.watermark;
+	tel->period = ns_to_ktime(div_u64(NSEC_PER_SEC, config.rate_hz));
+	tel->owner = file;
+	hrtimer_start(&tel->timer, tel->period, HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static int fw_telemetry_init(struct fw_telemetry *tel)
+{
+	struct fw_telemetry_ring *ring;
+
+	BUILD_BUG_ON(sizeof(struct fw_telemetry_ring) > PAGE_SIZE);
+
+	tel->size = PAGE_ALIGN(PAGE_SIZE + FW_TELEMETRY_RECORDS *
+			       sizeof(struct fw_telemetry_record));
+	ring = vmalloc_user(tel->size);
+	if (!ring)
+		return -ENOMEM;
+
+	ring->version = FW_TELEMETRY_VERSION;
+	ring->record_size = sizeof(struct fw_telemetry_record);
+	ring->nr_records = FW_TELEMETRY_RECORDS;
+	ring->data_offset = PAGE_SIZE;
+
+	tel->ring = ring;
+	tel->records = (void *)ring + PAGE_SIZE;
+
+	mutex_init(&tel->lock);
+	init_waitqueue_head(&tel->wait);
+	INIT_WORK(&tel->work, fw_telemetry_work);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&tel->timer, fw_telemetry_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&tel->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	tel->timer.function = fw_telemetry_timer;
+#endif
+
+	return 0;
+}
+
+/**** Batched requests ****/
+static int fw_batch_check(struct framework_data *data,
+			  const struct fw_batch_op *op)
+{
+	switch (op->type) {
+	case FW_BATCH_CHARGE_LIMIT:
+	case FW_BATCH_KB_BRIGHTNESS:
+		return op->value <= 100 ? 0 : -EINVAL;
+	case FW_BATCH_FP_BRIGHTNESS:
+		return op->value <= 2 ? 0 : -EINVAL;
+	case FW_BATCH_FAN_DUTY:
+		if (op->value > 100)
+			return -EINVAL;
+		fallthrough;
+	case FW_BATCH_FAN_RPM:
+		if (op->value > U32_MAX)
+			return -EINVAL;
+		fallthrough;
+	case FW_BATCH_FAN_AUTO:
+		return op->index < data->fan_count ? 0 : -EINVAL;
+	case FW_BATCH_LED_COLOR:
+	case FW_BATCH_LED_AUTO:
+		return data->batt_led.num_colors ? 0 : -EOPNOTSUPP;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int fw_batch_run(struct framework_data *data,
+			const struct fw_batch_op *op)
+{
+	switch (op->type) {
+	case FW_BATCH_CHARGE_LIMIT:
+		return fw_battery_set_limit(data, op->value);
+	case FW_BATCH_KB_BRIGHTNESS:
+		return fw_kb_led_set(data, op->value);
+	case FW_BATCH_FP_BRIGHTNESS:
+		return fw_fp_led_set(data, op->value);
+	/* A queued hwmon or LED class write would undo these later */
+	case FW_BATCH_FAN_DUTY:
+		fw_setpoint_fan_cancel(data, op->index);
+		return fw_fan_set_duty(data, op->index, op->value);
+	case FW_BATCH_FAN_RPM:
+		fw_setpoint_fan_cancel(data, op->index);
+		return fw_fan_set_rpm(data, op->index, op->value);
+	case FW_BATCH_FAN_AUTO:
+		return fw_fan_set_mode(data, op->index, FW_FAN_MODE_EC_AUTO);
+	case FW_BATCH_LED_COLOR:
+		fw_setpoint_led_cancel(data);
+		return fw_color_led_set(data, op->color);
+	case FW_BATCH_LED_AUTO:
+		return fw_color_led_auto(data);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Check every operation, then run them all, each gets its own result */
+int fw_batch_apply(struct framework_data *data, struct fw_batch_op *ops,
+		   u32 count)
+{
+	int ret = 0;
+
+	/* Don't send anything unless the whole batch makes sense */
+	for (u32 i = 0; i < count; i++) {
+		ops[i].result = fw_batch_check(data, &ops[i]);
+		if (ops[i].result)
+			ret = -EINVAL;
+	}
+
+	/* The EC commands go out back to back, with no trips to userspace */
+	for (u32 i = 0; !ret && i < count; i++)
+		ops[i].result = fw_batch_run(data, &ops[i]);
+
+	return ret;
+}
+
+static long fw_batch_ioctl(struct framework_data *data, void __user *argp)
+{
+	struct fw_batch batch;
+	struct fw_batch_op *ops;
+	void __user *uops;
+	long ret;
+
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
+
+	if (!batch.count || batch.count > FW_BATCH_MAX_OPS || batch.reserved)
+		return -EINVAL;
+
+	uops = u64_to_user_ptr(batch.ops);
+	ops = memdup_user(uops, batch.count * sizeof(*ops));
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
+
+	ret = fw_batch_apply(data, ops, batch.count);
+
+	if (copy_to_user(uops, ops, batch.count * sizeof(*ops)))
+		ret = -EFAULT;
+
+	kfree(ops);
+
+	return ret;
+}
+
+/**** File operations ****/
+static struct fw_cdev *fw_cdev_get(struct file *file)
+{
+	struct miscdevice *misc = file->private_data;
+
+	return container_of(misc, struct fw_cdev, misc);
+}
+
+/* The last file has closed and the device is gone, so the timer is stopped */
+static void fw_cdev_free(struct kref *ref)
+{
+	struct fw_cdev *cdev = container_of(ref, struct fw_cdev, ref);
+
+	vfree(cdev->telemetry.ring);
+	kfree(cdev);
+}
+
+/* Called under misc_open()'s lock, so misc_deregister() can't race it */
+static int fw_cdev_open(struct inode *inode, struct file *file)
+{
+	kref_get(&fw_cdev_get(file)->ref);
+
+	return 0;
+}
+
+static int fw_cdev_release(struct inode *inode, struct file *file)
+{
+	struct fw_cdev *cdev = fw_cdev_get(file);
+	struct fw_telemetry *tel = &cdev->telemetry;
+
+	mutex_lock(&tel->lock);
+	if (tel->owner == file)
+		fw_telemetry_stop(tel);
+	mutex_unlock(&tel->lock);
+
+	kref_put(&cdev->ref, fw_cdev_free);
+
+	return 0;
+}
+
+static int fw_cdev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fw_cdev *cdev = fw_cdev_get(file);
+	struct fw_telemetry *tel = &cdev->telemetry;
+
+	if (!READ_ONCE(cdev->data))
+		return -ENODEV;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > tel->size)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, tel->ring, 0);
+}
+
+static __poll_t fw_cdev_poll(struct file *file, poll_table *wait)
+{
+	struct fw_cdev *cdev = fw_cdev_get(file);
+	struct fw_telemetry *tel = &cdev->telemetry;
+
+	poll_wait(file, &tel->wait, wait);
+
+	if (!READ_ONCE(cdev->data))
+		return EPOLLERR | EPOLLHUP;
+
+	if (tel->owner == file &&
+	    tel->head - READ_ONCE(tel->ring->tail) >= tel->watermark)
+		return EPOLLIN | EPOLLRDNORM;
+
+	return 0;
+}
+
+/* Holds the telemetry lock throughout, so the device can't go away */
+static long fw_cdev_ioctl(struct file *file, unsigned int cmd,
+			  unsigned long arg)
+{
+	struct fw_cdev *cdev = fw_cdev_get(file);
+	struct fw_telemetry *tel = &cdev->telemetry;
+	void __user *argp = (void __user *)arg;
+	long ret;
+
+	mutex_lock(&tel->lock);
+
+	if (!cdev->data) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	switch (cmd) {
+	case FW_IOC_TELEMETRY_START:
+		ret = fw_telemetry_start(tel, file, argp);
+		break;
+	case FW_IOC_TELEMETRY_STOP:
+		if (tel->owner == file)
+			fw_telemetry_stop(tel);
+		ret = 0;
+		break;
+	case FW_IOC_BATCH:
+		ret = fw_batch_ioctl(cdev->data, argp);
+		break;
+	default:
+		ret = -ENOTTY;
+	}
+
+out:
+	mutex_unlock(&tel->lock);
+	return ret;
+}
+
+static const struct file_operations fw_cdev_fops = {
+	.owner = THIS_MODULE,
+	.open = fw_cdev_open,
+	.release = fw_cdev_release,
+	.mmap = fw_cdev_mmap,
+	.poll = fw_cdev_poll,
+	.unlocked_ioctl = fw_cdev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = noop_llseek,
+};
+
+int fw_cdev_register(struct framework_data *data)
+{
+	struct fw_cdev *cdev;
+	int ret;
+
+	cdev = kzalloc(sizeof(*cdev), GFP_KERNEL);
+	if (!cdev)
+		return -ENOMEM;
+
+	kref_init(&cdev->ref);
+	cdev->data = data;
+
+	ret = fw_telemetry_init(&cdev->telemetry);
+	if (ret)
+		goto err_free;
+
+	cdev->misc.minor = MISC_DYNAMIC_MINOR;
+	cdev->misc.name = DRV_NAME;
+	cdev->misc.fops = &fw_cdev_fops;
+	cdev->misc.parent = &data->pdev->dev;
+	cdev->misc.mode = 0600;
+
+	ret = misc_register(&cdev->misc);
+	if (ret)
+		goto err_free;
+
+	data->cdev = cdev;
+
+	return 0;
+
+err_free:
+	vfree(cdev->telemetry.ring);
+	kfree(cdev);
+	return ret;
+}
+
+void fw_cdev_unregister(struct framework_data *data)
+{
+	struct fw_cdev *cdev = data->cdev;
+	struct fw_telemetry *tel;
+
+	if (!cdev)
+		return;
+
+	tel = &cdev->telemetry;
+	misc_deregister(&cdev->misc);
+
+	/* Files still open get -ENODEV from here on */
+	mutex_lock(&tel->lock);
+	fw_telemetry_stop(tel);
+	WRITE_ONCE(cdev->data, NULL);
+	mutex_unlock(&tel->lock);
+	wake_up_interruptible(&tel->wait);
+
+	data->cdev = NULL;
+	kref_put(&cdev->ref, fw_cdev_free);
+}
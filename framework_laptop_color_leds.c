@@ -15,37 +15,29 @@
 #include <linux/types.h>
 #include <linux/platform_device.h>
 #include <linux/leds.h>
+#include <linux/led-class-multicolor.h>
 #include <linux/platform_data/cros_ec_commands.h>
 #include <linux/platform_data/cros_ec_proto.h>
 
 #include "framework_laptop.h"
 
-static struct device *ec_device;
-
-/* Set the LED's brightness */
-static int ec_led_set(struct led_classdev *led, enum led_brightness value)
+/* Set every color of the LED with one command, in the EC's own ranges */
+int fw_color_led_set(struct framework_data *data, const u8 *brightness)
 {
-	struct cros_ec_device *ec;
 	int ret;
 
-	struct framework_led *fw_led =
-		container_of(led, struct framework_led, led);
-
-	struct ec_params_led_control params = { .led_id = fw_led->id,
+	struct ec_params_led_control params = { .led_id = EC_LED_ID_BATTERY_LED,
 						.flags = 0 };
 
-	memset(params.brightness, 0, sizeof(params.brightness));
-	params.brightness[fw_led->color] = value;
-
 	struct ec_response_led_control resp;
 
-	if (!ec_device)
-		return -EIO;
-
-	ec = dev_get_drvdata(ec_device);
+	/* Colors the EC doesn't support stay at 0 */
+	for (uint i = 0; i < EC_LED_COLOR_COUNT; i++)
+		params.brightness[i] = min(brightness[i],
+					   data->batt_led_range[i]);
 
-	ret = cros_ec_cmd(ec, 1, EC_CMD_LED_CONTROL, &params, sizeof(params),
-			  &resp, sizeof(resp));
+	ret = fw_ec_cmd(data, 1, EC_CMD_LED_CONTROL, &params, sizeof(params),
+			&resp, sizeof(resp));
 	if (ret < 0) {
 		return -EIO;
 	}
@@ -53,170 +45,168 @@ static int ec_led_set(struct led_classdev *led, enum led_brightness value)
 	return 0;
 }
 
-/* Query the max LED brightness */
-static int ec_led_max(struct led_classdev *led)
+static struct framework_data *to_fw_data(struct led_classdev *led)
 {
-	struct cros_ec_device *ec;
-	int ret;
+	return container_of(lcdev_to_mccdev(led), struct framework_data,
+			    batt_led);
+}
 
-	struct framework_led *fw_led =
-		container_of(led, struct framework_led, led);
+static int ec_led_set(struct led_classdev *led, enum led_brightness value)
+{
+	struct framework_data *data = to_fw_data(led);
+	struct led_classdev_mc *mc_led = lcdev_to_mccdev(led);
+	u8 brightness[EC_LED_COLOR_COUNT] = {};
 
-	struct ec_params_led_control params = { .led_id = fw_led->id,
-						.flags = EC_LED_FLAGS_QUERY };
+	led_mc_calc_color_components(mc_led, value);
 
-	struct ec_response_led_control resp;
+	for (uint i = 0; i < mc_led->num_colors; i++) {
+		struct mc_subled *subled = &mc_led->subled_info[i];
+		u8 range = data->batt_led_range[subled->channel];
 
-	if (!ec_device)
-		return -EIO;
+		brightness[subled->channel] = DIV_ROUND_CLOSEST(
+			subled->brightness * range, led->max_brightness);
+	}
+
+	if (fw_setpoint_led(data, brightness))
+		return 0;
 
-	ec = dev_get_drvdata(ec_device);
+	return fw_color_led_set(data, brightness);
+}
+
+/* Query the max brightness of every color at once */
+static int ec_led_ranges(struct framework_data *data, u8 *ranges)
+{
+	int ret;
+
+	struct ec_params_led_control params = { .led_id = EC_LED_ID_BATTERY_LED,
+						.flags = EC_LED_FLAGS_QUERY };
+
+	struct ec_response_led_control resp;
 
-	ret = cros_ec_cmd(ec, 1, EC_CMD_LED_CONTROL, &params, sizeof(params),
-			  &resp, sizeof(resp));
+	ret = fw_ec_cmd(data, 1, EC_CMD_LED_CONTROL, &params, sizeof(params),
+			&resp, sizeof(resp));
 	if (ret < 0) {
 		return -EIO;
 	}
 
-	return resp.brightness_range[fw_led->color];
+	memcpy(ranges, resp.brightness_range, EC_LED_COLOR_COUNT);
 
 	return 0;
 }
 
 static struct led_hw_trigger_type framework_hw_trigger_type;
 
-static int ec_trig_activate(struct led_classdev *led);
-static void ec_trig_deactivate(struct led_classdev *led);
-static struct led_trigger framework_led_trigger = {
-	.name = DRV_NAME,
-	.activate = ec_trig_activate,
-	.deactivate = ec_trig_deactivate,
-	.trigger_type = &framework_hw_trigger_type
-};
-
-static int ec_trig_activate(struct led_classdev *led)
+/* Hand control of the LED back to the EC */
+int fw_color_led_auto(struct framework_data *data)
 {
-	struct cros_ec_device *ec;
 	int ret;
 
-	struct framework_led *fw_led =
-		container_of(led, struct framework_led, led);
-
-	struct ec_params_led_control params = { .led_id = fw_led->id,
+	struct ec_params_led_control params = { .led_id = EC_LED_ID_BATTERY_LED,
 						.flags = EC_LED_FLAGS_AUTO };
 
 	struct ec_response_led_control resp;
 
-	if (!ec_device)
-		return -EIO;
-
-	ec = dev_get_drvdata(ec_device);
+	/* A queued brightness write would take it back */
+	fw_setpoint_led_cancel(data);
 
-	ret = cros_ec_cmd(ec, 1, EC_CMD_LED_CONTROL, &params, sizeof(params),
-			  &resp, sizeof(resp));
+	ret = fw_ec_cmd(data, 1, EC_CMD_LED_CONTROL, &params, sizeof(params),
+			&resp, sizeof(resp));
 	if (ret < 0) {
 		return -EIO;
 	}
 
-	/* Unset the trigger functions, so we don't get a loop */
-	framework_led_trigger.activate = NULL;
-	framework_led_trigger.deactivate = NULL;
-
-	for (int i = 0; i < EC_LED_COLOR_COUNT; i++) {
-		struct framework_led *other = &fw_led->others[i];
-		struct led_classdev *other_led = &other->led;
-
-		if (other_led != led)
-			led_trigger_set(other_led, &framework_led_trigger);
-	}
-
-	/* Reset the trigger functions */
-	framework_led_trigger.activate = ec_trig_activate;
-	framework_led_trigger.deactivate = ec_trig_deactivate;
-
 	return 0;
 }
 
-static void ec_trig_deactivate(struct led_classdev *led)
+static int ec_trig_activate(struct led_classdev *led)
 {
-	struct framework_led *fw_led =
-		container_of(led, struct framework_led, led);
-
-	/* Unset the trigger functions, so we don't get a loop */
-	framework_led_trigger.activate = NULL;
-	framework_led_trigger.deactivate = NULL;
-
-	for (int i = 0; i < EC_LED_COLOR_COUNT; i++) {
-		struct framework_led *other = &fw_led->others[i];
-		struct led_classdev *other_led = &other->led;
+	return fw_color_led_auto(to_fw_data(led));
+}
 
-		if (other_led != led)
-			led_trigger_set(other_led, NULL);
-	}
+static struct led_trigger framework_led_trigger = {
+	.name = DRV_NAME,
+	.activate = ec_trig_activate,
+	.trigger_type = &framework_hw_trigger_type
+};
 
-	/* Reset the trigger functions */
-	framework_led_trigger.activate = ec_trig_activate;
-	framework_led_trigger.deactivate = ec_trig_deactivate;
-}
+static const int ec_led_color_ids[EC_LED_COLOR_COUNT] = {
+	[EC_LED_COLOR_RED] = LED_COLOR_ID_RED,
+	[EC_LED_COLOR_GREEN] = LED_COLOR_ID_GREEN,
+	[EC_LED_COLOR_BLUE] = LED_COLOR_ID_BLUE,
+	[EC_LED_COLOR_YELLOW] = LED_COLOR_ID_YELLOW,
+	[EC_LED_COLOR_WHITE] = LED_COLOR_ID_WHITE,
+	[EC_LED_COLOR_AMBER] = LED_COLOR_ID_AMBER,
+};
 
 int fw_color_leds_register(struct framework_data *data)
 {
 	int ret;
 
 	struct device *dev = &data->pdev->dev;
+	struct led_classdev_mc *mc_led = &data->batt_led;
+	uint num_colors = 0;
+	uint max_brightness = 0;
 
-	ec_device = data->ec_device;
-
-	ret = devm_led_trigger_register(dev, &framework_led_trigger);
+	ret = ec_led_ranges(data, data->batt_led_range);
 	if (ret)
 		return ret;
 
-	const char *batt_led_names[EC_LED_COLOR_COUNT] = {
-		DRV_NAME ":red:" LED_FUNCTION_INDICATOR,
-		DRV_NAME ":green:" LED_FUNCTION_INDICATOR,
-		DRV_NAME ":blue:" LED_FUNCTION_INDICATOR,
-		DRV_NAME ":yellow:" LED_FUNCTION_INDICATOR,
-		DRV_NAME ":white:" LED_FUNCTION_INDICATOR,
-		DRV_NAME ":amber:" LED_FUNCTION_INDICATOR,
-	};
-
+	/* Only expose the colors the EC can actually drive */
 	for (uint i = 0; i < EC_LED_COLOR_COUNT; i++) {
-		data->batt_led[i].others = data->batt_led;
-		data->batt_led[i].id = EC_LED_ID_BATTERY_LED;
-		data->batt_led[i].color = i;
-		data->batt_led[i].led.name = batt_led_names[i];
-		data->fp_led.brightness_get = NULL;
-		data->batt_led[i].led.brightness_set_blocking = ec_led_set;
-		data->batt_led[i].led.max_brightness =
-			ec_led_max(&data->batt_led[i].led);
-
-		if (data->batt_led[i].led.max_brightness <= 0)
+		if (!data->batt_led_range[i])
 			continue;
 
-		data->batt_led[i].led.trigger_type = &framework_hw_trigger_type;
+		data->batt_subleds[num_colors].color_index =
+			ec_led_color_ids[i];
+		data->batt_subleds[num_colors].channel = i;
+		num_colors++;
 
-		ret = devm_led_classdev_register(dev, &data->batt_led[i].led);
-		if (ret)
-			return ret;
+		max_brightness = max_t(uint, max_brightness,
+				       data->batt_led_range[i]);
 	}
 
-	/* Set trigger */
-	/* Why aren't I using default_trigger? Because that will run for every color, instead of once for all of them */
-	ret = led_trigger_set(&data->batt_led[0].led, &framework_led_trigger);
+	if (!num_colors)
+		return 0;
+
+	ret = led_trigger_register(&framework_led_trigger);
 	if (ret)
 		return ret;
+	data->batt_trigger_registered = true;
+
+	mc_led->subled_info = data->batt_subleds;
+	mc_led->num_colors = num_colors;
+	mc_led->led_cdev.name = DRV_NAME ":multicolor:" LED_FUNCTION_INDICATOR;
+	mc_led->led_cdev.brightness_set_blocking = ec_led_set;
+	mc_led->led_cdev.max_brightness = max_brightness;
+	mc_led->led_cdev.trigger_type = &framework_hw_trigger_type;
+	/* Not off on unregister, it goes back to the EC instead */
+	mc_led->led_cdev.flags = LED_RETAIN_AT_SHUTDOWN;
+	/* Leave the EC in control until userspace says otherwise */
+	mc_led->led_cdev.default_trigger = DRV_NAME;
+
+	ret = devm_led_classdev_multicolor_register(dev, mc_led);
+	if (ret) {
+		mc_led->num_colors = 0;
+		led_trigger_unregister(&framework_led_trigger);
+		data->batt_trigger_registered = false;
+	}
 
-	return 0;
+	return ret;
 }
 
 void fw_color_leds_unregister(struct framework_data *data)
 {
 	struct device *dev = &data->pdev->dev;
 
-	for (uint i = 0; i < EC_LED_COLOR_COUNT; i++) {
-		if (data->batt_led[i].led.max_brightness <= 0)
-			devm_led_classdev_unregister(dev, &data->batt_led[i].led);
-	}
+	if (!data->batt_led.num_colors)
+		goto out;
 
-	led_trigger_unregister(&framework_led_trigger);
-}
\ No newline at end of file
+	devm_led_classdev_multicolor_unregister(dev, &data->batt_led);
+
+	/* Whatever userspace set, the EC shows the battery state again */
+	fw_color_led_auto(data);
+
+out:
+	if (data->batt_trigger_registered)
+		led_trigger_unregister(&framework_led_trigger);
+}
@@ -0,0 +1,952 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/jiffies.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+
+#define CREATE_TRACE_POINTS
+#include "framework_laptop_trace.h"
+
+static unsigned int memmap_cache_ms = 1000;
+module_param(memmap_cache_ms, uint, 0644);
+MODULE_PARM_DESC(memmap_cache_ms,
+		 "Milliseconds an EC memory map snapshot stays fresh (0 = off)");
+
+static unsigned int read_deadline_ms;
+module_param(read_deadline_ms, uint, 0644);
+MODULE_PARM_DESC(read_deadline_ms,
+		 "Serve the last good value if an EC read takes longer than this many ms (0 = off)");
+
+/* Circuit breaker, backs off from an EC that keeps failing */
+#define FW_EC_BREAKER_FAILURES 3
+#define FW_EC_BREAKER_MIN_MS 100
+#define FW_EC_BREAKER_MAX_MS 30000
+
+/**** EC command statistics ****/
+static void fw_ec_stats_record(struct framework_data *data,
+			       unsigned int version, int command, int result,
+			       u64 elapsed)
+{
+	struct fw_ec_stats *stats = &data->ec_stats;
+	struct fw_ec_cmd_stats *cmd = NULL;
+	unsigned int bucket;
+	unsigned long flags;
+
+	bucket = min_t(unsigned int, fls64(div_u64(elapsed, NSEC_PER_USEC)),
+		       FW_EC_LATENCY_BUCKETS - 1);
+
+	spin_lock_irqsave(&stats->lock, flags);
+
+	/* Slots are claimed in order, the first unused one ends the search */
+	for (int i = 0; i < FW_EC_STATS_COMMANDS; i++) {
+		cmd = &stats->cmds[i];
+		if (!cmd->calls || cmd->command == command)
+			break;
+		cmd = NULL;
+	}
+
+	if (cmd) {
+		if (!cmd->calls) {
+			cmd->command = command;
+			cmd->min_ns = U64_MAX;
+		}
+
+		cmd->version = version;
+		cmd->calls++;
+		if (result < 0)
+			cmd->errors++;
+		cmd->total_ns += elapsed;
+		cmd->min_ns = min(cmd->min_ns, elapsed);
+		cmd->max_ns = max(cmd->max_ns, elapsed);
+		cmd->buckets[bucket]++;
+	}
+
+	spin_unlock_irqrestore(&stats->lock, flags);
+}
+
+/**** EC command scheduler ****/
+/*
+ * Only one of our commands is sent to the EC at a time, and whoever is
+ * waiting in the interactive class goes before anything in background.
+ * Background is the memory map, read-only commands and anything sent from
+ * a worker (polling, fan curves, telemetry, events), everything else is a
+ * write straight from a user request.
+ */
+static const char *const fw_ec_prio_names[FW_EC_PRIO_COUNT] = {
+	[FW_EC_PRIO_INTERACTIVE] = "interactive",
+	[FW_EC_PRIO_BACKGROUND] = "background",
+};
+
+struct fw_ec_waiter {
+	struct list_head node;
+	struct completion granted;
+};
+
+static enum fw_ec_prio fw_ec_prio(bool readonly)
+{
+	if (readonly || (current->flags & PF_WQ_WORKER))
+		return FW_EC_PRIO_BACKGROUND;
+
+	return FW_EC_PRIO_INTERACTIVE;
+}
+
+static void fw_ec_sched_acquire(struct framework_data *data,
+				enum fw_ec_prio prio)
+{
+	struct fw_ec_sched *sched = &data->ec_sched;
+	struct fw_ec_sched_class *class = &sched->classes[prio];
+	struct fw_ec_waiter waiter;
+	u64 start, waited;
+
+	spin_lock(&sched->lock);
+
+	class->requests++;
+	if (!sched->busy) {
+		sched->busy = true;
+		spin_unlock(&sched->lock);
+		return;
+	}
+
+	init_completion(&waiter.granted);
+	list_add_tail(&waiter.node, &class->waiters);
+	class->depth++;
+	class->max_depth = max(class->max_depth, class->depth);
+	class->queued++;
+
+	spin_unlock(&sched->lock);
+
+	start = ktime_get_ns();
+	wait_for_completion(&waiter.granted);
+	waited = ktime_get_ns() - start;
+
+	spin_lock(&sched->lock);
+	class->wait_ns += waited;
+	class->max_wait_ns = max(class->max_wait_ns, waited);
+	spin_unlock(&sched->lock);
+}
+
+static void fw_ec_sched_release(struct framework_data *data)
+{
+	struct fw_ec_sched *sched = &data->ec_sched;
+	struct fw_ec_waiter *next = NULL;
+
+	spin_lock(&sched->lock);
+
+	/* Classes are in priority order */
+	for (int i = 0; i < FW_EC_PRIO_COUNT && !next; i++) {
+		struct fw_ec_sched_class *class = &sched->classes[i];
+
+		next = list_first_entry_or_null(&class->waiters,
+						struct fw_ec_waiter, node);
+		if (next) {
+			list_del(&next->node);
+			class->depth--;
+		}
+	}
+
+	/* Hand the EC straight over, so nobody can sneak in between */
+	if (next)
+		complete(&next->granted);
+	else
+		sched->busy = false;
+
+	spin_unlock(&sched->lock);
+}
+
+static int fw_ec_sched_show(struct seq_file *s, void *unused)
+{
+	struct framework_data *data = s->private;
+	struct fw_ec_sched *sched = &data->ec_sched;
+	struct fw_ec_sched_class classes[FW_EC_PRIO_COUNT];
+
+	spin_lock(&sched->lock);
+	memcpy(classes, sched->classes, sizeof(classes));
+	spin_unlock(&sched->lock);
+
+	seq_puts(s, "class requests queued depth max_depth avg_wait_us max_wait_us\n");
+	for (int i = 0; i < FW_EC_PRIO_COUNT; i++) {
+		struct fw_ec_sched_class *class = &classes[i];
+		u64 avg_us = 0;
+
+		if (class->queued)
+			avg_us = div64_u64(class->wait_ns,
+					   class->queued * NSEC_PER_USEC);
+
+		seq_printf(s, "%s %llu %llu %u %u %llu %llu\n",
+			   fw_ec_prio_names[i], class->requests, class->queued,
+			   class->depth, class->max_depth, avg_us,
+			   div_u64(class->max_wait_ns, NSEC_PER_USEC));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fw_ec_sched);
+
+/**** EC health ****/
+/* Errors that say the EC (or the way to it) is in trouble */
+static bool fw_ec_failed(int ret)
+{
+	return ret == -ETIMEDOUT || ret == -EIO || ret == -EBUSY ||
+	       ret == -EAGAIN;
+}
+
+static void fw_ec_health_record(struct framework_data *data, int ret)
+{
+	struct fw_ec_health *health = &data->ec_health;
+	unsigned long flags;
+
+	if (ret < 0 && !fw_ec_failed(ret))
+		return;
+
+	spin_lock_irqsave(&health->lock, flags);
+
+	if (ret >= 0) {
+		health->failures = 0;
+		health->backoff_ms = 0;
+	} else if (++health->failures >= FW_EC_BREAKER_FAILURES) {
+		/* Every failed retry doubles the wait for the next one */
+		health->backoff_ms = clamp_t(unsigned int,
+					     health->backoff_ms * 2,
+					     FW_EC_BREAKER_MIN_MS,
+					     FW_EC_BREAKER_MAX_MS);
+		health->retry_at = jiffies +
+				   msecs_to_jiffies(health->backoff_ms);
+		health->backoffs++;
+	}
+
+	spin_unlock_irqrestore(&health->lock, flags);
+}
+
+/* Should reads stay away from the EC for now? */
+static bool fw_ec_breaker_open(struct framework_data *data)
+{
+	struct fw_ec_health *health = &data->ec_health;
+	bool open;
+
+	spin_lock_irq(&health->lock);
+	open = health->failures >= FW_EC_BREAKER_FAILURES &&
+	       time_before(jiffies, health->retry_at);
+	spin_unlock_irq(&health->lock);
+
+	return open;
+}
+
+/* Must be called with the health lock held */
+static struct fw_ec_last_good *
+fw_ec_last_good_find(struct fw_ec_health *health, unsigned int version,
+		     int command, const void *outdata, size_t outsize,
+		     size_t insize)
+{
+	for (int i = 0; i < FW_EC_LAST_GOOD_ENTRIES; i++) {
+		struct fw_ec_last_good *entry = &health->last_good[i];
+
+		if (entry->insize && entry->command == command &&
+		    entry->version == version && entry->outsize == outsize &&
+		    entry->insize == insize &&
+		    !memcmp(entry->buf, outdata, outsize))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void fw_ec_last_good_store(struct framework_data *data,
+				  unsigned int version, int command,
+				  const void *outdata, size_t outsize,
+				  const void *indata, size_t insize)
+{
+	struct fw_ec_health *health = &data->ec_health;
+	struct fw_ec_last_good *entry;
+
+	if (!insize || outsize + insize > FW_EC_LAST_GOOD_SIZE)
+		return;
+
+	spin_lock_irq(&health->lock);
+
+	entry = fw_ec_last_good_find(health, version, command, outdata,
+				     outsize, insize);
+	if (!entry) {
+		/* Take a free slot, or the one that was updated longest ago */
+		entry = &health->last_good[0];
+		for (int i = 1; i < FW_EC_LAST_GOOD_ENTRIES; i++) {
+			struct fw_ec_last_good *other = &health->last_good[i];
+
+			if (!entry->insize)
+				break;
+			if (!other->insize ||
+			    time_before(other->timestamp, entry->timestamp))
+				entry = other;
+		}
+
+		entry->command = command;
+		entry->version = version;
+		entry->outsize = outsize;
+		entry->insize = insize;
+		memcpy(entry->buf, outdata, outsize);
+	}
+
+	memcpy(entry->buf + outsize, indata, insize);
+	entry->timestamp = jiffies;
+
+	spin_unlock_irq(&health->lock);
+}
+
+static void fw_ec_count_stale(struct framework_data *data)
+{
+	spin_lock_irq(&data->ec_health.lock);
+	data->ec_health.stale++;
+	spin_unlock_irq(&data->ec_health.lock);
+}
+
+/* Copy out the last good response, if there is one */
+static int fw_ec_last_good_load(struct framework_data *data,
+				unsigned int version, int command,
+				const void *outdata, size_t outsize,
+				void *indata, size_t insize)
+{
+	struct fw_ec_health *health = &data->ec_health;
+	struct fw_ec_last_good *entry;
+	int ret = -ENODATA;
+
+	spin_lock_irq(&health->lock);
+
+	entry = fw_ec_last_good_find(health, version, command, outdata,
+				     outsize, insize);
+	if (entry) {
+		memcpy(indata, entry->buf + outsize, insize);
+		health->stale++;
+		ret = insize;
+	}
+
+	spin_unlock_irq(&health->lock);
+
+	return ret;
+}
+
+static int fw_ec_health_show(struct seq_file *s, void *unused)
+{
+	struct framework_data *data = s->private;
+	struct fw_ec_health *health = &data->ec_health;
+	struct fw_ec_health *copy;
+	unsigned long now = jiffies;
+	unsigned long retry_ms = 0;
+
+	/* Take a copy so we aren't printing with the lock held */
+	copy = kmalloc(sizeof(*copy), GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+
+	spin_lock_irq(&health->lock);
+	memcpy(copy, health, sizeof(*copy));
+	spin_unlock_irq(&health->lock);
+
+	if (copy->failures >= FW_EC_BREAKER_FAILURES &&
+	    time_before(now, copy->retry_at))
+		retry_ms = jiffies_to_msecs(copy->retry_at - now);
+
+	seq_printf(s, "breaker %s\n", retry_ms ? "open" : "closed");
+	seq_printf(s, "failures %u\n", copy->failures);
+	seq_printf(s, "backoff_ms %u\n", copy->backoff_ms);
+	seq_printf(s, "retry_in_ms %lu\n", retry_ms);
+	seq_printf(s, "backoffs %llu\n", copy->backoffs);
+	seq_printf(s, "stale_reads %llu\n", copy->stale);
+
+	/* How old the value a stale read would get is */
+	seq_puts(s, "\nsource age_ms\n");
+	mutex_lock(&data->memmap.lock);
+	if (data->memmap.good)
+		seq_printf(s, "readmem %u\n",
+			   jiffies_to_msecs(now - data->memmap.timestamp));
+	mutex_unlock(&data->memmap.lock);
+
+	for (int i = 0; i < FW_EC_LAST_GOOD_ENTRIES; i++) {
+		struct fw_ec_last_good *entry = &copy->last_good[i];
+
+		if (!entry->insize)
+			continue;
+
+		seq_printf(s, "0x%04x %u\n", entry->command,
+			   jiffies_to_msecs(now - entry->timestamp));
+	}
+
+	kfree(copy);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fw_ec_health);
+
+static int __fw_ec_cmd(struct framework_data *data, enum fw_ec_prio prio,
+		       unsigned int version, int command, const void *outdata,
+		       size_t outsize, void *indata, size_t insize,
+		       unsigned long caller)
+{
+	struct cros_ec_device *ec = dev_get_drvdata(data->ec_device);
+	u64 start, elapsed;
+	int ret;
+
+	fw_ec_sched_acquire(data, prio);
+
+	trace_fw_ec_cmd_enter(command, version, outsize, insize, caller);
+
+	start = ktime_get_ns();
+	ret = cros_ec_cmd(ec, version, command, outdata, outsize, indata,
+			  insize);
+	elapsed = ktime_get_ns() - start;
+
+	fw_ec_sched_release(data);
+
+	trace_fw_ec_cmd_exit(command, version, outsize, insize, ret, elapsed);
+	fw_ec_stats_record(data, version, command, ret, elapsed);
+	fw_ec_health_record(data, ret);
+
+	return ret;
+}
+
+/* Send a command to the EC, same as cros_ec_cmd() */
+int fw_ec_cmd(struct framework_data *data, unsigned int version, int command,
+	      const void *outdata, size_t outsize, void *indata,
+	      size_t insize)
+{
+	if (!data->ec_device)
+		return -ENODEV;
+
+	return __fw_ec_cmd(data, fw_ec_prio(false), version, command, outdata,
+			   outsize, indata, insize, _RET_IP_);
+}
+
+/**** Single-flight EC reads ****/
+struct fw_ec_flight {
+	struct list_head node;
+	struct kref ref;
+	struct completion done;
+	struct work_struct work;
+	struct framework_data *data;
+	enum fw_ec_prio prio;
+	unsigned long caller;
+	unsigned int version;
+	int command;
+	size_t outsize;
+	size_t insize;
+	int result;
+	/* The request, followed by room for the response */
+	u8 buf[];
+};
+
+static void fw_ec_flight_free(struct kref *ref)
+{
+	kfree(container_of(ref, struct fw_ec_flight, ref));
+}
+
+/* Must be called with the flight lock held */
+static struct fw_ec_flight *
+fw_ec_flight_find(struct framework_data *data, unsigned int version,
+		  int command, const void *outdata, size_t outsize,
+		  size_t insize)
+{
+	struct fw_ec_flight *flight;
+
+	list_for_each_entry(flight, &data->ec_flights.list, node) {
+		if (flight->command == command && flight->version == version &&
+		    flight->outsize == outsize && flight->insize == insize &&
+		    !memcmp(flight->buf, outdata, outsize))
+			return flight;
+	}
+
+	return NULL;
+}
+
+static void fw_ec_flight_run(struct fw_ec_flight *flight)
+{
+	struct framework_data *data = flight->data;
+	struct fw_ec_singleflight *sf = &data->ec_flights;
+	int ret;
+
+	ret = __fw_ec_cmd(data, flight->prio, flight->version, flight->command,
+			  flight->buf, flight->outsize,
+			  flight->buf + flight->outsize, flight->insize,
+			  flight->caller);
+	if (ret >= 0)
+		fw_ec_last_good_store(data, flight->version, flight->command,
+				      flight->buf, flight->outsize,
+				      flight->buf + flight->outsize,
+				      flight->insize);
+
+	/* Late arrivals start a new transaction from here on */
+	spin_lock(&sf->lock);
+	list_del(&flight->node);
+	flight->result = ret;
+	spin_unlock(&sf->lock);
+
+	complete_all(&flight->done);
+}
+
+/* Runs the command for a reader that won't wait past the deadline */
+static void fw_ec_flight_work(struct work_struct *work)
+{
+	struct fw_ec_flight *flight =
+		container_of(work, struct fw_ec_flight, work);
+
+	fw_ec_flight_run(flight);
+	kref_put(&flight->ref, fw_ec_flight_free);
+}
+
+static int fw_ec_flight_wait(struct fw_ec_flight *flight, void *indata)
+{
+	unsigned int deadline = READ_ONCE(read_deadline_ms);
+	int ret;
+
+	/* Without an older response to fall back on, wait it out */
+	if (deadline &&
+	    !wait_for_completion_timeout(&flight->done,
+					 msecs_to_jiffies(deadline))) {
+		ret = fw_ec_last_good_load(flight->data, flight->version,
+					   flight->command, flight->buf,
+					   flight->outsize, indata,
+					   flight->insize);
+		if (ret >= 0)
+			goto out;
+	}
+
+	wait_for_completion(&flight->done);
+
+	ret = flight->result;
+	if (ret >= 0)
+		memcpy(indata, flight->buf + flight->outsize, flight->insize);
+
+out:
+	kref_put(&flight->ref, fw_ec_flight_free);
+	return ret;
+}
+
+/*
+ * Same as fw_ec_cmd(), for commands that don't change anything on the EC.
+ * If an identical command is already in flight, wait for it and share its
+ * response instead of queueing another transaction behind it. Sent in the
+ * given scheduler class, see fw_ec_cmd_shared() for the usual one.
+ */
+int fw_ec_cmd_shared_prio(struct framework_data *data, enum fw_ec_prio prio,
+			  unsigned int version, int command,
+			  const void *outdata, size_t outsize, void *indata,
+			  size_t insize)
+{
+	struct fw_ec_singleflight *sf = &data->ec_flights;
+	struct fw_ec_flight *flight, *leader;
+	int ret;
+
+	if (!data->ec_device)
+		return -ENODEV;
+
+	/* Leave a struggling EC alone while there's something to show */
+	if (read_deadline_ms && data->ec_wq && fw_ec_breaker_open(data)) {
+		ret = fw_ec_last_good_load(data, version, command, outdata,
+					   outsize, indata, insize);
+		if (ret >= 0)
+			return ret;
+	}
+
+	/* Allocate up front, so lookup and insert share one critical section */
+	flight = kmalloc(struct_size(flight, buf, outsize + insize),
+			 GFP_KERNEL);
+	if (!flight)
+		return __fw_ec_cmd(data, prio, version, command, outdata,
+				   outsize, indata, insize, _RET_IP_);
+
+	spin_lock(&sf->lock);
+
+	leader = fw_ec_flight_find(data, version, command, outdata, outsize,
+				   insize);
+	if (leader) {
+		kref_get(&leader->ref);
+		sf->shared++;
+		spin_unlock(&sf->lock);
+		kfree(flight);
+
+		return fw_ec_flight_wait(leader, indata);
+	}
+
+	kref_init(&flight->ref);
+	init_completion(&flight->done);
+	INIT_WORK(&flight->work, fw_ec_flight_work);
+	flight->data = data;
+	flight->prio = prio;
+	flight->caller = _RET_IP_;
+	flight->version = version;
+	flight->command = command;
+	flight->outsize = outsize;
+	flight->insize = insize;
+	memcpy(flight->buf, outdata, outsize);
+	list_add_tail(&flight->node, &sf->list);
+	sf->issued++;
+
+	spin_unlock(&sf->lock);
+
+	/* A worker sends it, so we can give up on it at the deadline */
+	if (read_deadline_ms && data->ec_wq) {
+		kref_get(&flight->ref);
+		queue_work(data->ec_wq, &flight->work);
+	} else {
+		fw_ec_flight_run(flight);
+	}
+
+	return fw_ec_flight_wait(flight, indata);
+}
+
+/* Reads go behind writes, so a monitoring scrape can't hold up a user */
+int fw_ec_cmd_shared(struct framework_data *data, unsigned int version,
+		     int command, const void *outdata, size_t outsize,
+		     void *indata, size_t insize)
+{
+	return fw_ec_cmd_shared_prio(data, fw_ec_prio(true), version, command,
+				     outdata, outsize, indata, insize);
+}
+
+static int fw_ec_cmd_readmem(struct framework_data *data, unsigned int offset,
+			     unsigned int bytes, void *dest)
+{
+	struct cros_ec_device *ec = dev_get_drvdata(data->ec_device);
+	u64 start, elapsed;
+	int ret;
+
+	fw_ec_sched_acquire(data, fw_ec_prio(true));
+
+	trace_fw_ec_readmem_enter(offset, bytes);
+
+	start = ktime_get_ns();
+	ret = ec->cmd_readmem(ec, offset, bytes, dest);
+	elapsed = ktime_get_ns() - start;
+
+	fw_ec_sched_release(data);
+
+	trace_fw_ec_readmem_exit(offset, bytes, ret, elapsed);
+	fw_ec_stats_record(data, 0, FW_EC_CMD_READMEM, ret, elapsed);
+	fw_ec_health_record(data, ret);
+
+	return ret;
+}
+
+/* Upper bound of the bucket the 99th percentile call landed in */
+static u64 fw_ec_stats_p99_us(const struct fw_ec_cmd_stats *cmd)
+{
+	u64 target = div_u64(cmd->calls * 99 + 99, 100);
+	u64 seen = 0;
+
+	for (int i = 0; i < FW_EC_LATENCY_BUCKETS; i++) {
+		seen += cmd->buckets[i];
+		if (seen >= target)
+			return 1ULL << i;
+	}
+
+	return 1ULL << (FW_EC_LATENCY_BUCKETS - 1);
+}
+
+static int fw_ec_stats_show(struct seq_file *s, void *unused)
+{
+	struct framework_data *data = s->private;
+	struct fw_ec_stats *stats = &data->ec_stats;
+	struct fw_ec_cmd_stats *cmds;
+	int i, j;
+
+	/* Take a copy so we aren't printing with the lock held */
+	cmds = kmalloc(sizeof(stats->cmds), GFP_KERNEL);
+	if (!cmds)
+		return -ENOMEM;
+
+	spin_lock_irq(&stats->lock);
+	memcpy(cmds, stats->cmds, sizeof(stats->cmds));
+	spin_unlock_irq(&stats->lock);
+
+	seq_puts(s, "command ver calls errors min_us avg_us max_us p99_us\n");
+	for (i = 0; i < FW_EC_STATS_COMMANDS && cmds[i].calls; i++) {
+		if (cmds[i].command == FW_EC_CMD_READMEM)
+			seq_puts(s, "readmem");
+		else
+			seq_printf(s, "0x%04x", cmds[i].command);
+
+		seq_printf(s, " %u %llu %llu %llu %llu %llu %llu\n",
+			   cmds[i].version, cmds[i].calls, cmds[i].errors,
+			   div_u64(cmds[i].min_ns, NSEC_PER_USEC),
+			   div64_u64(cmds[i].total_ns,
+				     cmds[i].calls * NSEC_PER_USEC),
+			   div_u64(cmds[i].max_ns, NSEC_PER_USEC),
+			   fw_ec_stats_p99_us(&cmds[i]));
+	}
+
+	/* Bucket N counts calls that took less than 2^N microseconds */
+	seq_puts(s, "\nhistogram (log2 us)\n");
+	for (i = 0; i < FW_EC_STATS_COMMANDS && cmds[i].calls; i++) {
+		if (cmds[i].command == FW_EC_CMD_READMEM)
+			seq_puts(s, "readmem");
+		else
+			seq_printf(s, "0x%04x", cmds[i].command);
+
+		for (j = 0; j < FW_EC_LATENCY_BUCKETS; j++)
+			seq_printf(s, " %llu", cmds[i].buckets[j]);
+		seq_putc(s, '\n');
+	}
+
+	kfree(cmds);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fw_ec_stats);
+
+static ssize_t fw_ec_stats_reset_write(struct file *file,
+				       const char __user *buf, size_t count,
+				       loff_t *ppos)
+{
+	struct framework_data *data = file->private_data;
+	struct fw_ec_stats *stats = &data->ec_stats;
+
+	spin_lock_irq(&stats->lock);
+	memset(stats->cmds, 0, sizeof(stats->cmds));
+	spin_unlock_irq(&stats->lock);
+
+	return count;
+}
+
+static const struct file_operations fw_ec_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = fw_ec_stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+/**** EC memory map snapshot ****/
+/* Must be called with the cache lock held */
+static int fw_memmap_refresh(struct framework_data *data)
+{
+	struct fw_memmap_cache *cache = &data->memmap;
+	int ret;
+
+	/* One bulk read covers every fan, temperature and battery field */
+	ret = fw_ec_cmd_readmem(data, 0, sizeof(cache->raw), cache->raw);
+	if (ret < 0) {
+		cache->valid = false;
+		cache->good = false;
+		return ret;
+	}
+
+	cache->timestamp = jiffies;
+	cache->valid = true;
+	cache->good = true;
+	cache->updates++;
+
+	return 0;
+}
+
+/* Refresh without holding the cache lock, so readers can take the old one */
+static void fw_memmap_refresh_work(struct work_struct *work)
+{
+	struct fw_memmap_cache *cache =
+		container_of(work, struct fw_memmap_cache, refresh_work);
+	struct framework_data *data =
+		container_of(cache, struct framework_data, memmap);
+	int ret;
+
+	ret = fw_ec_cmd_readmem(data, 0, sizeof(cache->next), cache->next);
+
+	mutex_lock(&cache->lock);
+	if (ret >= 0) {
+		memcpy(cache->raw, cache->next, sizeof(cache->raw));
+		cache->timestamp = jiffies;
+		cache->valid = true;
+		cache->good = true;
+		cache->updates++;
+	}
+	cache->attempts++;
+	mutex_unlock(&cache->lock);
+
+	wake_up_all(&cache->wait);
+}
+
+/*
+ * Must be called with the cache lock held, which is dropped while waiting.
+ * Gives the EC until the read deadline, then settles for the old snapshot.
+ */
+static void fw_memmap_refresh_deadline(struct framework_data *data)
+{
+	struct fw_memmap_cache *cache = &data->memmap;
+	unsigned long attempts = cache->attempts;
+	unsigned long updates = cache->updates;
+
+	if (!fw_ec_breaker_open(data)) {
+		queue_work(data->ec_wq, &cache->refresh_work);
+
+		mutex_unlock(&cache->lock);
+		wait_event_timeout(cache->wait,
+				   READ_ONCE(cache->attempts) != attempts,
+				   msecs_to_jiffies(read_deadline_ms));
+		mutex_lock(&cache->lock);
+	}
+
+	if (cache->updates == updates)
+		fw_ec_count_stale(data);
+}
+
+static bool fw_memmap_fresh(struct fw_memmap_cache *cache)
+{
+	if (!cache->valid || !memmap_cache_ms)
+		return false;
+
+	return time_before(jiffies, cache->timestamp +
+					    msecs_to_jiffies(memmap_cache_ms));
+}
+
+/* Read from the EC's memory, served from the snapshot when possible */
+int fw_ec_readmem(struct framework_data *data, unsigned int offset,
+		  unsigned int bytes, void *dest)
+{
+	struct fw_memmap_cache *cache = &data->memmap;
+	struct cros_ec_device *ec;
+	int ret;
+
+	if (!data->ec_device)
+		return -ENODEV;
+
+	ec = dev_get_drvdata(data->ec_device);
+	if (!ec->cmd_readmem)
+		return -EOPNOTSUPP;
+
+	/* Strings and anything past the snapshot go straight to the EC */
+	if (!bytes || offset + bytes > sizeof(cache->raw))
+		return fw_ec_cmd_readmem(data, offset, bytes, dest);
+
+	mutex_lock(&cache->lock);
+
+	if (fw_memmap_fresh(cache)) {
+		cache->hits++;
+	} else if (read_deadline_ms && cache->good && data->ec_wq) {
+		cache->misses++;
+		fw_memmap_refresh_deadline(data);
+	} else {
+		cache->misses++;
+		ret = fw_memmap_refresh(data);
+		if (ret < 0)
+			goto out;
+	}
+
+	memcpy(dest, cache->raw + offset, bytes);
+	ret = bytes;
+
+out:
+	mutex_unlock(&cache->lock);
+	return ret;
+}
+
+/*
+ * Take a fresh copy of the whole snapshot, for callers that sample. With a
+ * read deadline, a slow or backed off EC gets the last good one instead.
+ */
+int fw_ec_memmap_snapshot(struct framework_data *data, u8 *raw)
+{
+	struct fw_memmap_cache *cache = &data->memmap;
+	struct cros_ec_device *ec;
+	int ret;
+
+	if (!data->ec_device)
+		return -ENODEV;
+
+	ec = dev_get_drvdata(data->ec_device);
+	if (!ec->cmd_readmem)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&cache->lock);
+
+	cache->misses++;
+	if (read_deadline_ms && cache->good && data->ec_wq) {
+		fw_memmap_refresh_deadline(data);
+		ret = 0;
+	} else {
+		ret = fw_memmap_refresh(data);
+	}
+	if (!ret)
+		memcpy(raw, cache->raw, sizeof(cache->raw));
+
+	mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+/* Force the next read to go to the EC */
+void fw_ec_memmap_invalidate(struct framework_data *data)
+{
+	mutex_lock(&data->memmap.lock);
+	data->memmap.valid = false;
+	mutex_unlock(&data->memmap.lock);
+}
+
+int fw_ec_register(struct framework_data *data)
+{
+	mutex_init(&data->memmap.lock);
+	init_waitqueue_head(&data->memmap.wait);
+	INIT_WORK(&data->memmap.refresh_work, fw_memmap_refresh_work);
+	spin_lock_init(&data->ec_health.lock);
+	spin_lock_init(&data->ec_stats.lock);
+	spin_lock_init(&data->ec_flights.lock);
+	INIT_LIST_HEAD(&data->ec_flights.list);
+	spin_lock_init(&data->ec_sched.lock);
+	for (int i = 0; i < FW_EC_PRIO_COUNT; i++)
+		INIT_LIST_HEAD(&data->ec_sched.classes[i].waiters);
+
+	debugfs_create_u64("memmap_cache_hits", 0444, data->debugfs,
+			   &data->memmap.hits);
+	debugfs_create_u64("memmap_cache_misses", 0444, data->debugfs,
+			   &data->memmap.misses);
+	debugfs_create_u64("ec_shared_issued", 0444, data->debugfs,
+			   &data->ec_flights.issued);
+	debugfs_create_u64("ec_shared_saved", 0444, data->debugfs,
+			   &data->ec_flights.shared);
+	debugfs_create_file("ec_stats", 0444, data->debugfs, data,
+			    &fw_ec_stats_fops);
+	debugfs_create_file("ec_stats_reset", 0200, data->debugfs, data,
+			    &fw_ec_stats_reset_fops);
+	debugfs_create_file("ec_sched", 0444, data->debugfs, data,
+			    &fw_ec_sched_fops);
+	debugfs_create_file("ec_health", 0444, data->debugfs, data,
+			    &fw_ec_health_fops);
+
+	/* Reads with a deadline are sent from here, without it they block */
+	data->ec_wq = alloc_workqueue(DRV_NAME, WQ_UNBOUND, 0);
+	if (!data->ec_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void fw_ec_unregister(struct framework_data *data)
+{
+	/* Let any reads a caller gave up on finish first */
+	if (data->ec_wq)
+		destroy_workqueue(data->ec_wq);
+	data->ec_wq = NULL;
+	mutex_destroy(&data->memmap.lock);
+}
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/powercap.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+
+static unsigned int energy_ms = 1000;
+module_param(energy_ms, uint, 0644);
+MODULE_PARM_DESC(energy_ms,
+		 "How often the battery is sampled for energy_uj, in ms (min 10)");
+
+/* Don't count across a gap this long, e.g. the EC not answering */
+#define FW_ENERGY_MAX_GAP_NS (10 * NSEC_PER_SEC)
+#define FW_FJ_PER_UJ 1000000000ULL
+
+/* Power drawn from the battery in uW, 0 while charging or on AC */
+u64 fw_energy_power_uw(const u8 *raw)
+{
+	u32 voltage, rate;
+
+	if (!(raw[EC_MEMMAP_BATT_FLAG] & EC_BATT_FLAG_DISCHARGING))
+		return 0;
+
+	memcpy(&voltage, raw + EC_MEMMAP_BATT_VOLT, sizeof(voltage));
+	memcpy(&rate, raw + EC_MEMMAP_BATT_RATE, sizeof(rate));
+
+	/* mV * mA is already uW */
+	return (u64)voltage * rate;
+}
+
+/* Trapezoidal integration between the last sample and this one */
+static void fw_energy_work(struct work_struct *work)
+{
+	struct fw_energy *energy =
+		container_of(to_delayed_work(work), struct fw_energy, work);
+	struct framework_data *data =
+		container_of(energy, struct framework_data, energy);
+	u8 raw[FW_MEMMAP_SNAPSHOT_SIZE];
+	u64 uw, elapsed;
+	ktime_t now;
+	u32 rem;
+
+	/* Keep the last value if the EC didn't answer */
+	if (fw_ec_memmap_snapshot(data, raw) < 0)
+		uw = READ_ONCE(energy->last_uw);
+	else
+		uw = fw_energy_power_uw(raw);
+
+	now = ktime_get();
+
+	spin_lock(&energy->lock);
+	elapsed = ktime_to_ns(ktime_sub(now, energy->last));
+	if (elapsed <= FW_ENERGY_MAX_GAP_NS) {
+		energy->remainder += (energy->last_uw + uw) / 2 * elapsed;
+		energy->energy_uj += div_u64_rem(energy->remainder,
+						 FW_FJ_PER_UJ, &rem);
+		energy->remainder = rem;
+	}
+	energy->last_uw = uw;
+	energy->last = now;
+	spin_unlock(&energy->lock);
+
+	queue_delayed_work(system_wq, &energy->work,
+			   msecs_to_jiffies(max(energy_ms, 10U)));
+}
+
+/* Microjoules drawn from the battery since the driver was loaded */
+u64 fw_energy_uj(struct framework_data *data)
+{
+	struct fw_energy *energy = &data->energy;
+	u64 uj;
+
+	spin_lock(&energy->lock);
+	uj = energy->energy_uj;
+	spin_unlock(&energy->lock);
+
+	return uj;
+}
+
+/**** powercap ****/
+static int fw_energy_get_energy_uj(struct powercap_zone *zone, u64 *uj)
+{
+	struct framework_data *data = powercap_get_zone_data(zone);
+
+	/* Only set once the zone is registered */
+	if (!data)
+		return -ENODEV;
+
+	*uj = fw_energy_uj(data);
+
+	return 0;
+}
+
+/* The counter is 64 bits, readers handle the wrap */
+static int fw_energy_get_max_energy_range_uj(struct powercap_zone *zone,
+					     u64 *uj)
+{
+	*uj = U64_MAX;
+
+	return 0;
+}
+
+static const struct powercap_zone_ops fw_energy_zone_ops = {
+	.get_energy_uj = fw_energy_get_energy_uj,
+	.get_max_energy_range_uj = fw_energy_get_max_energy_range_uj,
+};
+
+int fw_energy_register(struct framework_data *data)
+{
+	struct fw_energy *energy = &data->energy;
+	struct powercap_zone *zone;
+	int ret;
+
+	spin_lock_init(&energy->lock);
+	INIT_DELAYED_WORK(&energy->work, fw_energy_work);
+	energy->last = ktime_get();
+
+	energy->control_type =
+		powercap_register_control_type(NULL, DRV_NAME, NULL);
+	if (IS_ERR(energy->control_type)) {
+		ret = PTR_ERR(energy->control_type);
+		energy->control_type = NULL;
+		return ret;
+	}
+
+	/* No constraints, the zone only counts */
+	zone = powercap_register_zone(NULL, energy->control_type, "battery",
+				      NULL, &fw_energy_zone_ops, 0, NULL);
+	if (IS_ERR(zone)) {
+		powercap_unregister_control_type(energy->control_type);
+		energy->control_type = NULL;
+		return PTR_ERR(zone);
+	}
+	powercap_set_zone_data(zone, data);
+	energy->zone = zone;
+
+	queue_delayed_work(system_wq, &energy->work, 0);
+
+	return 0;
+}
+
+void fw_energy_unregister(struct framework_data *data)
+{
+	struct fw_energy *energy = &data->energy;
+
+	if (!energy->control_type)
+		return;
+
+	cancel_delayed_work_sync(&energy->work);
+	powercap_unregister_zone(energy->control_type, energy->zone);
+	powercap_unregister_control_type(energy->control_type);
+}
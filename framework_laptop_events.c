@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/hwmon.h>
+#include <linux/notifier.h>
+#include <linux/sysfs.h>
+#include <linux/workqueue.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+
+/* clang-format off */
+#define FW_HOST_EVENTS_THERMAL					\
+	(EC_HOST_EVENT_MASK(EC_HOST_EVENT_THERMAL_THRESHOLD) |	\
+	 EC_HOST_EVENT_MASK(EC_HOST_EVENT_THERMAL) |		\
+	 EC_HOST_EVENT_MASK(EC_HOST_EVENT_THERMAL_SHUTDOWN) |	\
+	 EC_HOST_EVENT_MASK(EC_HOST_EVENT_THROTTLE_START) |	\
+	 EC_HOST_EVENT_MASK(EC_HOST_EVENT_THROTTLE_STOP))
+
+#define FW_HOST_EVENTS_BATTERY					\
+	(EC_HOST_EVENT_MASK(EC_HOST_EVENT_AC_CONNECTED) |	\
+	 EC_HOST_EVENT_MASK(EC_HOST_EVENT_AC_DISCONNECTED) |	\
+	 EC_HOST_EVENT_MASK(EC_HOST_EVENT_BATTERY_LOW) |	\
+	 EC_HOST_EVENT_MASK(EC_HOST_EVENT_BATTERY_CRITICAL) |	\
+	 EC_HOST_EVENT_MASK(EC_HOST_EVENT_BATTERY) |		\
+	 EC_HOST_EVENT_MASK(EC_HOST_EVENT_BATTERY_STATUS))
+
+/* The EC handles the backlight Fn keys itself */
+#define FW_HOST_EVENTS_KB_LED					\
+	EC_HOST_EVENT_MASK(EC_HOST_EVENT_KEY_PRESSED)
+/* clang-format on */
+
+/* Is the EC going to tell us when things change? */
+bool fw_events_supported(struct framework_data *data)
+{
+	struct cros_ec_device *ec;
+
+	if (!data->ec_device)
+		return false;
+
+	ec = dev_get_drvdata(data->ec_device);
+
+	return ec->mkbp_event_supported;
+}
+
+/* Work out what an EC event could have changed */
+static unsigned long fw_decode_event(struct cros_ec_device *ec)
+{
+	unsigned long changed = 0;
+	u32 host_event;
+
+	switch (ec->event_data.event_type & EC_MKBP_EVENT_TYPE_MASK) {
+	case EC_MKBP_EVENT_HOST_EVENT:
+		host_event = cros_ec_get_host_event(ec);
+
+		if (host_event & FW_HOST_EVENTS_THERMAL)
+			changed |= FW_CHANGED_THERMAL;
+		if (host_event & FW_HOST_EVENTS_BATTERY)
+			changed |= FW_CHANGED_BATTERY;
+		if (host_event & FW_HOST_EVENTS_KB_LED)
+			changed |= FW_CHANGED_KB_LED;
+		break;
+
+	case EC_MKBP_EVENT_SWITCH:
+		/* Lid, chassis and privacy switches all come through here */
+		changed |= FW_CHANGED_SWITCHES;
+		break;
+
+	default:
+		break;
+	}
+
+	return changed;
+}
+
+static void fw_events_work(struct work_struct *work)
+{
+	struct framework_data *data =
+		container_of(work, struct framework_data, event_work);
+	unsigned long changed = atomic_long_xchg(&data->event_changed, 0);
+
+	if (changed & (FW_CHANGED_THERMAL | FW_CHANGED_BATTERY))
+		fw_ec_memmap_invalidate(data);
+
+	/* The LED class would warn about a backlight that isn't there */
+	if (changed & FW_CHANGED_KB_LED &&
+	    test_bit(FW_PROBE_LEDS, &data->probed))
+		fw_kb_led_refresh(data);
+
+	if (changed & FW_CHANGED_SWITCHES) {
+		fw_privacy_refresh(data);
+		sysfs_notify(&data->pdev->dev.kobj, NULL, "framework_privacy");
+	}
+
+	if (!data->hwmon_dev)
+		return;
+
+	if (changed & FW_CHANGED_THERMAL) {
+		for (int i = 0; i < data->fan_count; i++)
+			hwmon_notify_event(data->hwmon_dev, hwmon_fan,
+					   hwmon_fan_alarm, i);
+
+		for (int i = 0; i < FW_TEMP_SENSOR_ENTRIES; i++) {
+			if (data->temp_present & BIT(i))
+				hwmon_notify_event(data->hwmon_dev, hwmon_temp,
+						   hwmon_temp_input, i);
+		}
+	}
+
+	if (changed & FW_CHANGED_SWITCHES) {
+		hwmon_notify_event(data->hwmon_dev, hwmon_intrusion,
+				   hwmon_intrusion_alarm, 0);
+		hwmon_notify_event(data->hwmon_dev, hwmon_intrusion,
+				   hwmon_intrusion_alarm, 1);
+	}
+}
+
+static int fw_events_notify(struct notifier_block *nb,
+			    unsigned long queued_during_suspend, void *_notify)
+{
+	struct framework_data *data =
+		container_of(nb, struct framework_data, event_notifier);
+	struct cros_ec_device *ec = _notify;
+	unsigned long changed;
+
+	changed = fw_decode_event(ec);
+	if (!changed)
+		return NOTIFY_DONE;
+
+	/* Don't hold up the EC's event dispatch with our own EC commands */
+	atomic_long_or(changed, &data->event_changed);
+	schedule_work(&data->event_work);
+
+	return NOTIFY_OK;
+}
+
+int fw_events_register(struct framework_data *data)
+{
+	struct cros_ec_device *ec = dev_get_drvdata(data->ec_device);
+
+	INIT_WORK(&data->event_work, fw_events_work);
+
+	if (!fw_events_supported(data)) {
+		dev_info(&data->pdev->dev,
+			 DRV_NAME ": EC doesn't support events, polling.\n");
+		return 0;
+	}
+
+	data->event_notifier.notifier_call = fw_events_notify;
+
+	return blocking_notifier_chain_register(&ec->event_notifier,
+						&data->event_notifier);
+}
+
+void fw_events_unregister(struct framework_data *data)
+{
+	struct cros_ec_device *ec = dev_get_drvdata(data->ec_device);
+
+	if (data->event_notifier.notifier_call)
+		blocking_notifier_chain_unregister(&ec->event_notifier,
+						   &data->event_notifier);
+
+	cancel_work_sync(&data->event_work);
+}
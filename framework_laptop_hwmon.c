@@ -17,13 +17,14 @@
 #include <linux/leds.h>
 #include <linux/hwmon-sysfs.h>
 #include <linux/hwmon.h>
+#include <linux/thermal.h>
+#include <linux/units.h>
+#include <linux/workqueue.h>
 #include <linux/platform_data/cros_ec_commands.h>
 #include <linux/platform_data/cros_ec_proto.h>
 
 #include "framework_laptop.h"
 
-static struct device *ec_device;
-
 /**** Command definitions ****/
 
 /* clang-format off */
@@ -52,72 +53,60 @@ struct ec_response_chassis_open_check {
 
 /**** fanN_input ****/
 /* Read the current fan speed from the EC's memory */
-static ssize_t ec_get_fan_speed(u8 idx, u16 *val)
+static ssize_t ec_get_fan_speed(struct framework_data *data, u8 idx, u16 *val)
 {
-	if (!ec_device)
-		return -ENODEV;
-
-	struct cros_ec_device *ec = dev_get_drvdata(ec_device);
-
 	const u8 offset = EC_MEMMAP_FAN + 2 * idx;
 
-	return ec->cmd_readmem(ec, offset, sizeof(*val), val);
+	return fw_ec_readmem(data, offset, sizeof(*val), val);
 }
 
-static ssize_t fw_fan_speed_show(struct device *dev,
-				 struct device_attribute *attr, char *buf)
+/* A missing or stalled fan isn't spinning */
+static long ec_fan_rpm(u16 speed)
 {
-	struct sensor_device_attribute *sen_attr = to_sensor_dev_attr(attr);
+	if (speed == EC_FAN_SPEED_NOT_PRESENT || speed == EC_FAN_SPEED_STALLED)
+		return 0;
 
-	u16 val;
-	if (ec_get_fan_speed(sen_attr->index, &val) < 0) {
-		return -EIO;
-	}
+	return speed;
+}
 
-	if (val == EC_FAN_SPEED_NOT_PRESENT || val == EC_FAN_SPEED_STALLED) {
-		return sysfs_emit(buf, "%u\n", 0);
-	}
+/* fanN_input from a fw_ec_memmap_snapshot() */
+long fw_memmap_fan_rpm(const u8 *raw, u8 idx)
+{
+	u16 speed;
+
+	memcpy(&speed, raw + EC_MEMMAP_FAN + 2 * idx, sizeof(speed));
 
-	/* Format as string for sysfs */
-	return sysfs_emit(buf, "%u\n", val);
+	return ec_fan_rpm(speed);
 }
 
 /**** fanN_target ****/
-static ssize_t ec_set_target_rpm(u8 idx, u32 *val)
+static ssize_t ec_set_target_rpm(struct framework_data *data, u8 idx, u32 *val)
 {
 	int ret;
-	if (!ec_device)
-		return -ENODEV;
-
-	struct cros_ec_device *ec = dev_get_drvdata(ec_device);
 
 	struct ec_params_pwm_set_fan_target_rpm_v1 params = {
 		.rpm = *val,
 		.fan_idx = idx,
 	};
 
-	ret = cros_ec_cmd(ec, 1, EC_CMD_PWM_SET_FAN_TARGET_RPM, &params,
-			  sizeof(params), NULL, 0);
+	ret = fw_ec_cmd(data, 1, EC_CMD_PWM_SET_FAN_TARGET_RPM, &params,
+			sizeof(params), NULL, 0);
 	if (ret < 0)
 		return -EIO;
 
 	return 0;
 }
 
-static ssize_t ec_get_target_rpm(u8 idx, u32 *val)
+static ssize_t ec_get_target_rpm(struct framework_data *data, u8 idx, u32 *val)
 {
 	int ret;
-	if (!ec_device)
-		return -ENODEV;
-
-	struct cros_ec_device *ec = dev_get_drvdata(ec_device);
 
 	struct ec_response_pwm_get_fan_rpm resp;
 
 	/* index isn't supported, it should only return fan 0's target */
 
-	ret = cros_ec_cmd(ec, 0, EC_CMD_PWM_GET_FAN_TARGET_RPM, NULL, 0, &resp,
-			  sizeof(resp));
+	ret = fw_ec_cmd_shared(data, 0, EC_CMD_PWM_GET_FAN_TARGET_RPM, NULL, 0,
+			       &resp, sizeof(resp));
 	if (ret < 0)
 		return -EIO;
 
@@ -126,193 +115,655 @@ static ssize_t ec_get_target_rpm(u8 idx, u32 *val)
 	return 0;
 }
 
-static ssize_t fw_fan_target_store(struct device *dev,
-				   struct device_attribute *attr,
-				   const char *buf, size_t count)
+/**** pwmN_enable ****/
+static ssize_t ec_set_auto_fan_ctrl(struct framework_data *data, u8 idx)
 {
-	struct sensor_device_attribute *sen_attr = to_sensor_dev_attr(attr);
-	u32 val;
+	int ret;
 
-	int err;
-	err = kstrtou32(buf, 10, &val);
-	if (err < 0)
-		return err;
+	struct ec_params_auto_fan_ctrl_v1 params = {
+		.fan_idx = idx,
+	};
 
-	if (ec_set_target_rpm(sen_attr->index, &val) < 0) {
+	ret = fw_ec_cmd(data, 1, EC_CMD_THERMAL_AUTO_FAN_CTRL, &params,
+			sizeof(params), NULL, 0);
+	if (ret < 0)
 		return -EIO;
-	}
 
-	return count;
+	return 0;
 }
 
-static ssize_t fw_fan_target_show(struct device *dev,
-				  struct device_attribute *attr, char *buf)
+/**** pwmN ****/
+static ssize_t ec_set_fan_duty(struct framework_data *data, u8 idx, u32 *val)
 {
-	struct sensor_device_attribute *sen_attr = to_sensor_dev_attr(attr);
+	int ret;
 
-	/* Only fan 0 is supported */
-	if (sen_attr->index != 0) {
-		return -EINVAL;
-	}
+	struct ec_params_pwm_set_fan_duty_v1 params = {
+		.percent = *val,
+		.fan_idx = idx,
+	};
 
-	u32 val;
-	if (ec_get_target_rpm(sen_attr->index, &val) < 0) {
+	ret = fw_ec_cmd(data, 1, EC_CMD_PWM_SET_FAN_DUTY, &params,
+			sizeof(params), NULL, 0);
+	if (ret < 0)
 		return -EIO;
-	}
 
-	return sysfs_emit(buf, "%u\n", val);
+	return 0;
 }
 
-/**** fanN_fault ****/
-static ssize_t fw_fan_fault_show(struct device *dev,
-				 struct device_attribute *attr, char *buf)
+static ssize_t fw_pwm_min_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
 {
-	struct sensor_device_attribute *sen_attr = to_sensor_dev_attr(attr);
+	return sysfs_emit(buf, "%i\n", 0);
+}
+
+static ssize_t fw_pwm_max_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%i\n", 100);
+}
 
-	u16 val;
-	if (ec_get_fan_speed(sen_attr->index, &val) < 0) {
+static ssize_t ec_count_fans(struct framework_data *data, size_t *val)
+{
+	u16 fans[EC_FAN_SPEED_ENTRIES];
+
+	int ret = fw_ec_readmem(data, EC_MEMMAP_FAN, sizeof(fans), fans);
+	if (ret < 0)
 		return -EIO;
+
+	for (size_t i = 0; i < EC_FAN_SPEED_ENTRIES; i++) {
+		if (fans[i] == EC_FAN_SPEED_NOT_PRESENT) {
+			*val = i;
+			return 0;
+		}
 	}
 
-	return sysfs_emit(buf, "%u\n", val == EC_FAN_SPEED_NOT_PRESENT);
+	*val = EC_FAN_SPEED_ENTRIES;
+	return 0;
+}
+
+/**** tempN_input ****/
+static u8 ec_temp_offset(u8 idx)
+{
+	if (idx < EC_TEMP_SENSOR_ENTRIES)
+		return EC_MEMMAP_TEMP_SENSOR + idx;
+
+	return EC_MEMMAP_TEMP_SENSOR_B + idx - EC_TEMP_SENSOR_ENTRIES;
+}
+
+static ssize_t ec_get_temp(struct framework_data *data, u8 idx, u8 *val)
+{
+	return fw_ec_readmem(data, ec_temp_offset(idx), sizeof(*val), val);
+}
+
+static bool ec_temp_is_error(u8 temp)
+{
+	return temp == EC_TEMP_SENSOR_NOT_PRESENT ||
+	       temp == EC_TEMP_SENSOR_ERROR ||
+	       temp == EC_TEMP_SENSOR_NOT_POWERED ||
+	       temp == EC_TEMP_SENSOR_NOT_CALIBRATED;
 }
 
-/**** fanN_alarm ****/
-static ssize_t fw_fan_alarm_show(struct device *dev,
-				 struct device_attribute *attr, char *buf)
+static int ec_temp_decode(u8 temp, long *val)
 {
-	struct sensor_device_attribute *sen_attr = to_sensor_dev_attr(attr);
+	if (ec_temp_is_error(temp))
+		return -ENODATA;
 
-	u16 val;
-	if (ec_get_fan_speed(sen_attr->index, &val) < 0) {
+	*val = kelvin_to_millicelsius((long)temp + EC_TEMP_SENSOR_OFFSET);
+
+	return 0;
+}
+
+/* Read a temperature in millidegrees Celsius */
+static int fw_read_temp(struct framework_data *data, u8 idx, long *val)
+{
+	u8 temp;
+
+	if (ec_get_temp(data, idx, &temp) < 0)
 		return -EIO;
-	}
 
-	/* Format as string for sysfs */
-	return sysfs_emit(buf, "%u\n", val == EC_FAN_SPEED_STALLED);
+	return ec_temp_decode(temp, val);
 }
 
-/**** pwmN_enable ****/
-static ssize_t ec_set_auto_fan_ctrl(u8 idx)
+/* Same as fw_read_temp(), from a fw_ec_memmap_snapshot() */
+int fw_memmap_temp(const u8 *raw, u8 idx, long *val)
+{
+	return ec_temp_decode(raw[ec_temp_offset(idx)], val);
+}
+
+/**** tempN_label ****/
+/* Find the present sensors and cache their names, they never change */
+static int ec_probe_temp_sensors(struct framework_data *data)
 {
+	struct device *dev = &data->pdev->dev;
+	struct ec_params_temp_sensor_get_info params;
+	struct ec_response_temp_sensor_get_info resp;
+	u8 version, temp;
+	int count;
 	int ret;
-	if (!ec_device)
-		return -ENODEV;
 
-	struct cros_ec_device *ec = dev_get_drvdata(ec_device);
+	ret = fw_ec_readmem(data, EC_MEMMAP_THERMAL_VERSION, sizeof(version),
+			    &version);
+	if (ret < 0)
+		return ret;
 
-	struct ec_params_auto_fan_ctrl_v1 params = {
-		.fan_idx = idx,
-	};
+	/* No temperature data in the memory map */
+	if (version == 0)
+		return 0;
 
-	ret = cros_ec_cmd(ec, 1, EC_CMD_THERMAL_AUTO_FAN_CTRL, &params,
-			  sizeof(params), NULL, 0);
-	if (ret < 0)
-		return -EIO;
+	/* The second bank of sensors was added in version 2 */
+	count = version >= 2 ? FW_TEMP_SENSOR_ENTRIES : EC_TEMP_SENSOR_ENTRIES;
+
+	for (u8 i = 0; i < count; i++) {
+		ret = ec_get_temp(data, i, &temp);
+		if (ret < 0)
+			return ret;
+
+		if (temp == EC_TEMP_SENSOR_NOT_PRESENT)
+			continue;
+
+		data->temp_present |= BIT(i);
+
+		params.id = i;
+		ret = fw_ec_cmd(data, 0, EC_CMD_TEMP_SENSOR_GET_INFO, &params,
+				sizeof(params), &resp, sizeof(resp));
+		if (ret < 0)
+			continue;
+
+		data->temp_labels[i] =
+			devm_kasprintf(dev, GFP_KERNEL, "%.*s",
+				       (int)sizeof(resp.sensor_name),
+				       resp.sensor_name);
+	}
 
 	return 0;
 }
 
-static ssize_t fw_pwm_enable_store(struct device *dev,
-				   struct device_attribute *attr,
-				   const char *buf, size_t count)
+/**** pwmN_auto_pointM ****/
+static unsigned int fan_curve_ms = 500;
+module_param(fan_curve_ms, uint, 0644);
+MODULE_PARM_DESC(fan_curve_ms, "How often fan curves are applied in ms");
+
+/* Temperatures are in millidegrees Celsius, duty cycles in percent */
+static const long fw_fan_curve_default_temp[FW_FAN_CURVE_POINTS] = {
+	40000, 50000, 60000, 70000, 80000,
+};
+static const long fw_fan_curve_default_pwm[FW_FAN_CURVE_POINTS] = {
+	0, 20, 40, 70, 100,
+};
+
+/* The hottest of the temperatures the curve follows */
+static int fw_fan_curve_temp(struct framework_data *data,
+			     struct fw_fan_curve *curve, long *temp)
 {
-	struct sensor_device_attribute *sen_attr = to_sensor_dev_attr(attr);
+	unsigned long channels = curve->channels ?: data->temp_present;
+	bool found = false;
+	unsigned int i;
+	long val;
+
+	for_each_set_bit(i, &channels, FW_TEMP_SENSOR_ENTRIES) {
+		if (fw_read_temp(data, i, &val) < 0)
+			continue;
+
+		if (!found || val > *temp)
+			*temp = val;
+		found = true;
+	}
 
-	/* The EC doesn't take any arguments for this command,
-	so we don't need to parse the buffer */
+	return found ? 0 : -ENODATA;
+}
 
-	if (ec_set_auto_fan_ctrl(sen_attr->index) < 0) {
-		return -EIO;
+/* Interpolate between the points either side of the temperature */
+static long fw_fan_curve_duty(struct fw_fan_curve *curve, long temp)
+{
+	if (temp <= curve->temp[0])
+		return curve->pwm[0];
+
+	for (int i = 1; i < FW_FAN_CURVE_POINTS; i++) {
+		long t0 = curve->temp[i - 1], t1 = curve->temp[i];
+		long p0 = curve->pwm[i - 1], p1 = curve->pwm[i];
+
+		if (temp >= t1)
+			continue;
+
+		if (t1 <= t0)
+			return p1;
+
+		return p0 + DIV_ROUND_CLOSEST((p1 - p0) * (temp - t0), t1 - t0);
 	}
 
-	return count;
+	return curve->pwm[FW_FAN_CURVE_POINTS - 1];
 }
 
-/**** pwmN ****/
-static ssize_t ec_set_fan_duty(u8 idx, u32 *val)
+/* Must be called with the fan lock held */
+static void fw_fan_curve_update(struct framework_data *data, u8 idx)
+{
+	struct fw_fan_curve *curve = &data->fan_curve[idx];
+	long temp, duty;
+	u32 value;
+
+	if (fw_fan_curve_temp(data, curve, &temp) < 0)
+		return;
+
+	duty = fw_fan_curve_duty(curve, temp);
+
+	/* Only talk to the EC when the output actually changes */
+	if (duty == curve->duty)
+		return;
+
+	/* Don't slow down until it has cooled off by the hysteresis */
+	if (curve->duty >= 0 && duty < curve->duty &&
+	    temp > curve->duty_temp - curve->hyst)
+		return;
+
+	value = duty;
+	if (ec_set_fan_duty(data, idx, &value) < 0)
+		return;
+
+	curve->duty = duty;
+	curve->duty_temp = temp;
+}
+
+static void fw_fan_curve_work(struct work_struct *work)
+{
+	struct framework_data *data =
+		container_of(to_delayed_work(work), struct framework_data,
+			     fan_curve_work);
+	unsigned int interval = max(fan_curve_ms, 100U);
+	bool active = false;
+
+	mutex_lock(&data->fan_lock);
+
+	for (u8 i = 0; i < data->fan_count; i++) {
+		if (data->fan_curve[i].mode != FW_FAN_MODE_CURVE)
+			continue;
+
+		fw_fan_curve_update(data, i);
+		active = true;
+	}
+
+	mutex_unlock(&data->fan_lock);
+
+	/* Stops by itself once no fan follows a curve */
+	if (active)
+		schedule_delayed_work(&data->fan_curve_work,
+				      msecs_to_jiffies(interval));
+}
+
+/* Setting a duty cycle or target takes the fan off automatic control */
+int fw_fan_set_duty(struct framework_data *data, u8 idx, u32 percent)
 {
+	struct fw_fan_curve *curve = &data->fan_curve[idx];
 	int ret;
-	if (!ec_device)
-		return -ENODEV;
 
-	struct cros_ec_device *ec = dev_get_drvdata(ec_device);
+	if (percent > 100)
+		return -EINVAL;
 
-	struct ec_params_pwm_set_fan_duty_v1 params = {
-		.percent = *val,
-		.fan_idx = idx,
-	};
+	mutex_lock(&data->fan_lock);
+	curve->mode = FW_FAN_MODE_MANUAL;
+	ret = ec_set_fan_duty(data, idx, &percent);
+	curve->duty = ret < 0 ? -1 : percent;
+	curve->rpm = -1;
+	mutex_unlock(&data->fan_lock);
+	if (ret < 0)
+		return -EIO;
+
+	return 0;
+}
 
-	ret = cros_ec_cmd(ec, 1, EC_CMD_PWM_SET_FAN_DUTY, &params,
-			  sizeof(params), NULL, 0);
+int fw_fan_set_rpm(struct framework_data *data, u8 idx, u32 rpm)
+{
+	struct fw_fan_curve *curve = &data->fan_curve[idx];
+	int ret;
+
+	mutex_lock(&data->fan_lock);
+	curve->mode = FW_FAN_MODE_MANUAL;
+	ret = ec_set_target_rpm(data, idx, &rpm);
+	curve->duty = -1;
+	curve->rpm = ret < 0 ? -1 : rpm;
+	mutex_unlock(&data->fan_lock);
 	if (ret < 0)
 		return -EIO;
 
 	return 0;
 }
 
-static ssize_t fw_pwm_store(struct device *dev, struct device_attribute *attr,
-			    const char *buf, size_t count)
+/**** pwmN_enable ****/
+int fw_fan_set_mode(struct framework_data *data, u8 idx, long mode)
 {
-	struct sensor_device_attribute *sen_attr = to_sensor_dev_attr(attr);
-	u32 val;
+	struct fw_fan_curve *curve = &data->fan_curve[idx];
+	int ret = 0;
+
+	/* A queued pwmN or fanN_target write would undo this */
+	if (mode != FW_FAN_MODE_MANUAL)
+		fw_setpoint_fan_cancel(data, idx);
+
+	mutex_lock(&data->fan_lock);
+
+	switch (mode) {
+	case FW_FAN_MODE_MANUAL:
+		/* The next pwmN or fanN_target write takes over */
+		break;
+	case FW_FAN_MODE_EC_AUTO:
+		if (ec_set_auto_fan_ctrl(data, idx) < 0)
+			ret = -EIO;
+		break;
+	case FW_FAN_MODE_CURVE:
+		/* Force the first duty cycle out */
+		curve->duty = -1;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	if (!ret)
+		curve->mode = mode;
+
+	mutex_unlock(&data->fan_lock);
+
+	if (!ret && mode == FW_FAN_MODE_CURVE)
+		mod_delayed_work(system_wq, &data->fan_curve_work, 0);
+
+	return ret;
+}
+
+static ssize_t fw_auto_point_temp_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
+{
+	struct sensor_device_attribute_2 *sen_attr = to_sensor_dev_attr_2(attr);
+	struct framework_data *data = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%ld\n",
+			  data->fan_curve[sen_attr->nr].temp[sen_attr->index]);
+}
+
+static ssize_t fw_auto_point_temp_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	struct sensor_device_attribute_2 *sen_attr = to_sensor_dev_attr_2(attr);
+	struct framework_data *data = dev_get_drvdata(dev);
+	long val;
 
 	int err;
-	err = kstrtou32(buf, 10, &val);
+	err = kstrtol(buf, 10, &val);
 	if (err < 0)
 		return err;
 
-	if (ec_set_fan_duty(sen_attr->index, &val) < 0) {
-		return -EIO;
-	}
+	if (val < 0 || val > FW_FAN_CURVE_MAX_TEMP)
+		return -EINVAL;
+
+	mutex_lock(&data->fan_lock);
+	data->fan_curve[sen_attr->nr].temp[sen_attr->index] = val;
+	mutex_unlock(&data->fan_lock);
 
 	return count;
 }
 
-static ssize_t fw_pwm_min_show(struct device *dev,
-			       struct device_attribute *attr, char *buf)
+static ssize_t fw_auto_point_pwm_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
 {
-	return sysfs_emit(buf, "%i\n", 0);
+	struct sensor_device_attribute_2 *sen_attr = to_sensor_dev_attr_2(attr);
+	struct framework_data *data = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%ld\n",
+			  data->fan_curve[sen_attr->nr].pwm[sen_attr->index]);
 }
 
-static ssize_t fw_pwm_max_show(struct device *dev,
-			       struct device_attribute *attr, char *buf)
+static ssize_t fw_auto_point_pwm_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
 {
-	return sysfs_emit(buf, "%i\n", 100);
+	struct sensor_device_attribute_2 *sen_attr = to_sensor_dev_attr_2(attr);
+	struct framework_data *data = dev_get_drvdata(dev);
+	long val;
+
+	int err;
+	err = kstrtol(buf, 10, &val);
+	if (err < 0)
+		return err;
+
+	if (val < 0 || val > 100)
+		return -EINVAL;
+
+	mutex_lock(&data->fan_lock);
+	data->fan_curve[sen_attr->nr].pwm[sen_attr->index] = val;
+	mutex_unlock(&data->fan_lock);
+
+	return count;
 }
 
-static ssize_t ec_count_fans(size_t *val)
+static ssize_t fw_auto_point_hyst_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
 {
-	if (!ec_device)
-		return -ENODEV;
+	struct sensor_device_attribute_2 *sen_attr = to_sensor_dev_attr_2(attr);
+	struct framework_data *data = dev_get_drvdata(dev);
 
-	struct cros_ec_device *ec = dev_get_drvdata(ec_device);
+	return sysfs_emit(buf, "%ld\n", data->fan_curve[sen_attr->nr].hyst);
+}
 
-	u16 fans[EC_FAN_SPEED_ENTRIES];
+static ssize_t fw_auto_point_hyst_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	struct sensor_device_attribute_2 *sen_attr = to_sensor_dev_attr_2(attr);
+	struct framework_data *data = dev_get_drvdata(dev);
+	long val;
 
-	int ret = ec->cmd_readmem(ec, EC_MEMMAP_FAN, sizeof(fans), fans);
-	if (ret < 0)
-		return -EIO;
+	int err;
+	err = kstrtol(buf, 10, &val);
+	if (err < 0)
+		return err;
 
-	for (size_t i = 0; i < EC_FAN_SPEED_ENTRIES; i++) {
-		if (fans[i] == EC_FAN_SPEED_NOT_PRESENT) {
-			*val = i;
-			return 0;
+	if (val < 0 || val > FW_FAN_CURVE_MAX_TEMP)
+		return -EINVAL;
+
+	mutex_lock(&data->fan_lock);
+	data->fan_curve[sen_attr->nr].hyst = val;
+	mutex_unlock(&data->fan_lock);
+
+	return count;
+}
+
+static struct attribute *
+fw_fan_curve_attr(struct sensor_device_attribute_2 *sen_attr, const char *name,
+		  ssize_t (*show)(struct device *, struct device_attribute *,
+				  char *),
+		  ssize_t (*store)(struct device *, struct device_attribute *,
+				   const char *, size_t),
+		  u8 nr, u8 index)
+{
+	if (!name)
+		return NULL;
+
+	sysfs_attr_init(&sen_attr->dev_attr.attr);
+	sen_attr->dev_attr.attr.name = name;
+	sen_attr->dev_attr.attr.mode = 0644;
+	sen_attr->dev_attr.show = show;
+	sen_attr->dev_attr.store = store;
+	sen_attr->nr = nr;
+	sen_attr->index = index;
+
+	return &sen_attr->dev_attr.attr;
+}
+
+/* Build the curve attributes for the fans that are actually there */
+static int fw_fan_curve_init(struct framework_data *data)
+{
+	struct device *dev = &data->pdev->dev;
+	size_t count = data->fan_count * FW_FAN_CURVE_ATTRS;
+	struct sensor_device_attribute_2 *sen_attrs;
+	struct attribute **attrs;
+	size_t n = 0;
+
+	mutex_init(&data->fan_lock);
+	INIT_DELAYED_WORK(&data->fan_curve_work, fw_fan_curve_work);
+
+	for (u8 i = 0; i < EC_FAN_SPEED_ENTRIES; i++) {
+		struct fw_fan_curve *curve = &data->fan_curve[i];
+
+		/* The EC is in charge until told otherwise */
+		curve->mode = FW_FAN_MODE_EC_AUTO;
+		curve->duty = -1;
+		curve->rpm = -1;
+		curve->hyst = 2000;
+		memcpy(curve->temp, fw_fan_curve_default_temp,
+		       sizeof(curve->temp));
+		memcpy(curve->pwm, fw_fan_curve_default_pwm,
+		       sizeof(curve->pwm));
+	}
+
+	sen_attrs = devm_kcalloc(dev, count, sizeof(*sen_attrs), GFP_KERNEL);
+	attrs = devm_kcalloc(dev, count + 1, sizeof(*attrs), GFP_KERNEL);
+	if (!sen_attrs || !attrs)
+		return -ENOMEM;
+
+	for (u8 i = 0; i < data->fan_count; i++) {
+		for (u8 j = 0; j < FW_FAN_CURVE_POINTS; j++) {
+			attrs[n] = fw_fan_curve_attr(
+				&sen_attrs[n],
+				devm_kasprintf(dev, GFP_KERNEL,
+					       "pwm%u_auto_point%u_temp", i + 1,
+					       j + 1),
+				fw_auto_point_temp_show,
+				fw_auto_point_temp_store, i, j);
+			if (!attrs[n++])
+				return -ENOMEM;
+
+			attrs[n] = fw_fan_curve_attr(
+				&sen_attrs[n],
+				devm_kasprintf(dev, GFP_KERNEL,
+					       "pwm%u_auto_point%u_pwm", i + 1,
+					       j + 1),
+				fw_auto_point_pwm_show,
+				fw_auto_point_pwm_store, i, j);
+			if (!attrs[n++])
+				return -ENOMEM;
 		}
+
+		attrs[n] = fw_fan_curve_attr(
+			&sen_attrs[n],
+			devm_kasprintf(dev, GFP_KERNEL,
+				       "pwm%u_auto_point_temp_hyst", i + 1),
+			fw_auto_point_hyst_show, fw_auto_point_hyst_store, i,
+			0);
+		if (!attrs[n++])
+			return -ENOMEM;
 	}
 
-	*val = EC_FAN_SPEED_ENTRIES;
+	data->fan_curve_group.attrs = attrs;
+
 	return 0;
 }
 
-/**** intrusionN ****/
-static ssize_t ec_chassis_intrusion(u8 *val, bool clear)
+/* Don't leave the fans at a fixed speed once we're gone */
+static void fw_fan_curve_exit(struct framework_data *data)
 {
+	cancel_delayed_work_sync(&data->fan_curve_work);
+
+	for (u8 i = 0; i < data->fan_count; i++) {
+		if (data->fan_curve[i].mode == FW_FAN_MODE_CURVE)
+			ec_set_auto_fan_ctrl(data, i);
+	}
+}
+
+/**** Cooling devices ****/
+/* State 0 hands the fan to the EC, the rest are fixed duty cycles */
+#define FW_FAN_COOLING_STATES 10
+
+static int fw_fan_cooling_get_max_state(struct thermal_cooling_device *cdev,
+					unsigned long *state)
+{
+	*state = FW_FAN_COOLING_STATES;
+
+	return 0;
+}
+
+static int fw_fan_cooling_get_cur_state(struct thermal_cooling_device *cdev,
+					unsigned long *state)
+{
+	struct fw_fan_cooling *cooling = cdev->devdata;
+
+	*state = cooling->state;
+
+	return 0;
+}
+
+static int fw_fan_cooling_set_cur_state(struct thermal_cooling_device *cdev,
+					unsigned long state)
+{
+	struct fw_fan_cooling *cooling = cdev->devdata;
+	struct framework_data *data = cooling->data;
+	u32 duty;
 	int ret;
-	if (!ec_device)
-		return -ENODEV;
 
-	struct cros_ec_device *ec = dev_get_drvdata(ec_device);
+	if (state > FW_FAN_COOLING_STATES)
+		return -EINVAL;
+
+	if (state == 0) {
+		ret = fw_fan_set_mode(data, cooling->idx, FW_FAN_MODE_EC_AUTO);
+		if (!ret)
+			cooling->state = 0;
+		return ret;
+	}
+
+	duty = DIV_ROUND_UP(state * 100, FW_FAN_COOLING_STATES);
+
+	/* A queued pwmN write would undo this */
+	fw_setpoint_fan_cancel(data, cooling->idx);
+
+	ret = fw_fan_set_duty(data, cooling->idx, duty);
+	if (!ret)
+		cooling->state = state;
+
+	return ret;
+}
+
+static const struct thermal_cooling_device_ops fw_fan_cooling_ops = {
+	.get_max_state = fw_fan_cooling_get_max_state,
+	.get_cur_state = fw_fan_cooling_get_cur_state,
+	.set_cur_state = fw_fan_cooling_set_cur_state,
+};
+
+static void fw_fan_cooling_register(struct framework_data *data)
+{
+	struct device *dev = &data->pdev->dev;
+
+	for (u8 i = 0; i < data->fan_count; i++) {
+		struct fw_fan_cooling *cooling = &data->fan_cooling[i];
+		struct thermal_cooling_device *cdev;
+
+		cooling->data = data;
+		cooling->idx = i;
+
+		cdev = thermal_cooling_device_register("Fan", cooling,
+						       &fw_fan_cooling_ops);
+		if (IS_ERR(cdev)) {
+			dev_warn(dev, DRV_NAME ": fan %u has no cooling device.\n",
+				 i + 1);
+			continue;
+		}
+
+		cooling->cdev = cdev;
+	}
+}
+
+static void fw_fan_cooling_unregister(struct framework_data *data)
+{
+	for (u8 i = 0; i < data->fan_count; i++) {
+		if (!data->fan_cooling[i].cdev)
+			continue;
+
+		thermal_cooling_device_unregister(data->fan_cooling[i].cdev);
+		data->fan_cooling[i].cdev = NULL;
+	}
+}
+
+/**** intrusionN ****/
+static ssize_t ec_chassis_intrusion(struct framework_data *data, u8 *val,
+				    bool clear)
+{
+	int ret;
 
 	struct ec_params_chassis_intrusion_control params = {
 		.clear_magic = 0,
@@ -321,8 +772,14 @@ static ssize_t ec_chassis_intrusion(u8 *val, bool clear)
 
 	struct ec_response_chassis_intrusion_control resp;
 
-	ret = cros_ec_cmd(ec, 0, EC_CMD_CHASSIS_INTRUSION, &params,
-			  sizeof(params), &resp, sizeof(resp));
+	/* Only a clear changes anything */
+	if (clear)
+		ret = fw_ec_cmd(data, 0, EC_CMD_CHASSIS_INTRUSION, &params,
+				sizeof(params), &resp, sizeof(resp));
+	else
+		ret = fw_ec_cmd_shared(data, 0, EC_CMD_CHASSIS_INTRUSION,
+				       &params, sizeof(params), &resp,
+				       sizeof(resp));
 	if (ret < 0)
 		return -EIO;
 
@@ -331,18 +788,14 @@ static ssize_t ec_chassis_intrusion(u8 *val, bool clear)
 	return 0;
 }
 
-static ssize_t ec_chassis_open(u8 *val)
+static ssize_t ec_chassis_open(struct framework_data *data, u8 *val)
 {
 	int ret;
-	if (!ec_device)
-		return -ENODEV;
-
-	struct cros_ec_device *ec = dev_get_drvdata(ec_device);
 
 	struct ec_response_chassis_open_check resp;
 
-	ret = cros_ec_cmd(ec, 0, EC_CMD_CHASSIS_OPEN_CHECK, NULL, 0, &resp,
-			  sizeof(resp));
+	ret = fw_ec_cmd_shared(data, 0, EC_CMD_CHASSIS_OPEN_CHECK, NULL, 0,
+			       &resp, sizeof(resp));
 	if (ret < 0)
 		return -EIO;
 
@@ -351,187 +804,360 @@ static ssize_t ec_chassis_open(u8 *val)
 	return 0;
 }
 
-static ssize_t fw_intrusion_store(struct device *dev,
-				  struct device_attribute *attr,
-				  const char *buf, size_t count)
+/**** hwmon callbacks ****/
+static int fw_fan_read(struct framework_data *data, u32 attr, int channel,
+		       long *val)
 {
-	int err;
+	u16 speed;
+	u32 rpm;
 
-	u8 val;
-	u8 clear;
-	err = kstrtou8(buf, 10, &clear);
-	if (err < 0)
-		return err;
+	if (attr == hwmon_fan_target) {
+		if (ec_get_target_rpm(data, channel, &rpm) < 0)
+			return -EIO;
+
+		*val = rpm;
+		return 0;
+	}
 
-	if (ec_chassis_intrusion(&val, clear == 0) < 0) {
+	if (ec_get_fan_speed(data, channel, &speed) < 0)
 		return -EIO;
+
+	switch (attr) {
+	case hwmon_fan_input:
+		*val = ec_fan_rpm(speed);
+		return 0;
+	case hwmon_fan_fault:
+		*val = speed == EC_FAN_SPEED_NOT_PRESENT;
+		return 0;
+	case hwmon_fan_alarm:
+		*val = speed == EC_FAN_SPEED_STALLED;
+		return 0;
+	default:
+		return -EOPNOTSUPP;
 	}
+}
 
-	return count;
+static int fw_temp_read(struct framework_data *data, u32 attr, int channel,
+			long *val)
+{
+	if (attr != hwmon_temp_input)
+		return -EOPNOTSUPP;
+
+	return fw_read_temp(data, channel, val);
+}
+
+static int fw_pwm_read(struct framework_data *data, u32 attr, int channel,
+		       long *val)
+{
+	struct fw_fan_curve *curve = &data->fan_curve[channel];
+
+	switch (attr) {
+	case hwmon_pwm_enable:
+		*val = curve->mode;
+		return 0;
+	case hwmon_pwm_auto_channels_temp:
+		*val = curve->channels;
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
 }
 
-static ssize_t fw_intrusion_show(struct device *dev,
-				 struct device_attribute *attr, char *buf)
+static int fw_intrusion_read(struct framework_data *data, u32 attr,
+			     int channel, long *val)
 {
-	struct sensor_device_attribute *sen_attr = to_sensor_dev_attr(attr);
 	int err;
 
-	u8 val;
-	switch (sen_attr->index) {
+	u8 status;
+	switch (channel) {
 	case 0:
-		err = ec_chassis_intrusion(&val, false);
+		err = ec_chassis_intrusion(data, &status, false);
 		break;
 	case 1:
-		err = ec_chassis_open(&val);
+		err = ec_chassis_open(data, &status);
 		break;
 
 	default:
 		return -EINVAL;
 	}
 
-	if (err < 0) {
+	if (err < 0)
 		return -EIO;
+
+	*val = status;
+
+	return 0;
+}
+
+/* fan1_target, the EC only reports the first fan's */
+int fw_fan_get_target(struct framework_data *data, u32 *rpm)
+{
+	return ec_get_target_rpm(data, 0, rpm);
+}
+
+/* intrusion0_alarm, and intrusion1_alarm for whether it's open now */
+int fw_intrusion_get(struct framework_data *data, int channel, long *val)
+{
+	return fw_intrusion_read(data, hwmon_intrusion_alarm, channel, val);
+}
+
+static int fw_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
+			 u32 attr, int channel, long *val)
+{
+	struct framework_data *data = dev_get_drvdata(dev);
+
+	switch (type) {
+	case hwmon_fan:
+		return fw_fan_read(data, attr, channel, val);
+	case hwmon_temp:
+		return fw_temp_read(data, attr, channel, val);
+	case hwmon_pwm:
+		return fw_pwm_read(data, attr, channel, val);
+	case hwmon_intrusion:
+		return fw_intrusion_read(data, attr, channel, val);
+	default:
+		return -EOPNOTSUPP;
 	}
+}
+
+static int fw_hwmon_read_string(struct device *dev,
+				enum hwmon_sensor_types type, u32 attr,
+				int channel, const char **str)
+{
+	struct framework_data *data = dev_get_drvdata(dev);
 
-	return sysfs_emit(buf, "%u\n", val);
+	if (type != hwmon_temp || attr != hwmon_temp_label)
+		return -EOPNOTSUPP;
+
+	*str = data->temp_labels[channel];
+
+	return 0;
 }
 
-#define FW_ATTRS_PER_FAN 8
+static int fw_hwmon_write(struct device *dev, enum hwmon_sensor_types type,
+			  u32 attr, int channel, long val)
+{
+	struct framework_data *data = dev_get_drvdata(dev);
+	u8 status;
+
+	switch (type) {
+	case hwmon_fan:
+		if (attr != hwmon_fan_target)
+			return -EOPNOTSUPP;
+		if (val < 0 || val > U32_MAX)
+			return -EINVAL;
 
-/**** hwmon sysfs attributes ****/
-/* Fans */
-/* clang-format off */
-static SENSOR_DEVICE_ATTR_RO(fan1_input, fw_fan_speed, 0); /* Fan Reading */
-static SENSOR_DEVICE_ATTR_RW(fan1_target, fw_fan_target, 0); /* Target RPM (RW on fan 0 only) */
-static SENSOR_DEVICE_ATTR_RO(fan1_fault, fw_fan_fault, 0); /* Fan Not Present */
-static SENSOR_DEVICE_ATTR_RO(fan1_alarm, fw_fan_alarm, 0); /* Fan Stalled */
-static SENSOR_DEVICE_ATTR_WO(pwm1_enable, fw_pwm_enable, 0); /* Set Fan Control Mode */
-static SENSOR_DEVICE_ATTR_WO(pwm1, fw_pwm, 0); /* Set Fan Speed */
-static SENSOR_DEVICE_ATTR_RO(pwm1_min, fw_pwm_min, 0); /* Min Fan Speed */
-static SENSOR_DEVICE_ATTR_RO(pwm1_max, fw_pwm_max, 0); /* Max Fan Speed */
-/* clang-format on */
+		if (fw_setpoint_fan(data, channel, FW_SETPOINT_FAN_RPM, val))
+			return 0;
+		return fw_fan_set_rpm(data, channel, val);
+
+	case hwmon_pwm:
+		switch (attr) {
+		case hwmon_pwm_input:
+			if (val < 0 || val > 100)
+				return -EINVAL;
+
+			if (fw_setpoint_fan(data, channel, FW_SETPOINT_FAN_DUTY,
+					    val))
+				return 0;
+			return fw_fan_set_duty(data, channel, val);
+		case hwmon_pwm_enable:
+			return fw_fan_set_mode(data, channel, val);
+		case hwmon_pwm_auto_channels_temp:
+			if (val < 0 || val & ~data->temp_present)
+				return -EINVAL;
+
+			mutex_lock(&data->fan_lock);
+			data->fan_curve[channel].channels = val;
+			mutex_unlock(&data->fan_lock);
+			return 0;
+		default:
+			return -EOPNOTSUPP;
+		}
 
-static SENSOR_DEVICE_ATTR_RO(fan2_input, fw_fan_speed, 1);
-static SENSOR_DEVICE_ATTR_WO(fan2_target, fw_fan_target, 1);
-static SENSOR_DEVICE_ATTR_RO(fan2_fault, fw_fan_fault, 1);
-static SENSOR_DEVICE_ATTR_RO(fan2_alarm, fw_fan_alarm, 1);
-static SENSOR_DEVICE_ATTR_WO(pwm2_enable, fw_pwm_enable, 1);
-static SENSOR_DEVICE_ATTR_WO(pwm2, fw_pwm, 1);
-static SENSOR_DEVICE_ATTR_RO(pwm2_min, fw_pwm_min, 1);
-static SENSOR_DEVICE_ATTR_RO(pwm2_max, fw_pwm_max, 1);
+	case hwmon_intrusion:
+		/* Only intrusion0 can be cleared, by writing 0 */
+		if (channel != 0)
+			return -EOPNOTSUPP;
 
-static SENSOR_DEVICE_ATTR_RO(fan3_input, fw_fan_speed, 2);
-static SENSOR_DEVICE_ATTR_WO(fan3_target, fw_fan_target, 2);
-static SENSOR_DEVICE_ATTR_RO(fan3_fault, fw_fan_fault, 2);
-static SENSOR_DEVICE_ATTR_RO(fan3_alarm, fw_fan_alarm, 2);
-static SENSOR_DEVICE_ATTR_WO(pwm3_enable, fw_pwm_enable, 2);
-static SENSOR_DEVICE_ATTR_WO(pwm3, fw_pwm, 2);
-static SENSOR_DEVICE_ATTR_RO(pwm3_min, fw_pwm_min, 2);
-static SENSOR_DEVICE_ATTR_RO(pwm3_max, fw_pwm_max, 2);
+		if (ec_chassis_intrusion(data, &status, val == 0) < 0)
+			return -EIO;
+		return 0;
 
-static SENSOR_DEVICE_ATTR_RO(fan4_input, fw_fan_speed, 3);
-static SENSOR_DEVICE_ATTR_WO(fan4_target, fw_fan_target, 3);
-static SENSOR_DEVICE_ATTR_RO(fan4_fault, fw_fan_fault, 3);
-static SENSOR_DEVICE_ATTR_RO(fan4_alarm, fw_fan_alarm, 3);
-static SENSOR_DEVICE_ATTR_WO(pwm4_enable, fw_pwm_enable, 3);
-static SENSOR_DEVICE_ATTR_WO(pwm4, fw_pwm, 3);
-static SENSOR_DEVICE_ATTR_RO(pwm4_min, fw_pwm_min, 3);
-static SENSOR_DEVICE_ATTR_RO(pwm4_max, fw_pwm_max, 3);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
 
-static struct attribute
-	*fw_fans_attrs[(EC_FAN_SPEED_ENTRIES * FW_ATTRS_PER_FAN) + 1] = {
-		&sensor_dev_attr_fan1_input.dev_attr.attr,
-		&sensor_dev_attr_fan1_target.dev_attr.attr,
-		&sensor_dev_attr_fan1_fault.dev_attr.attr,
-		&sensor_dev_attr_fan1_alarm.dev_attr.attr,
-		&sensor_dev_attr_pwm1_enable.dev_attr.attr,
-		&sensor_dev_attr_pwm1.dev_attr.attr,
-		&sensor_dev_attr_pwm1_min.dev_attr.attr,
-		&sensor_dev_attr_pwm1_max.dev_attr.attr,
-
-		&sensor_dev_attr_fan2_input.dev_attr.attr,
-		&sensor_dev_attr_fan2_target.dev_attr.attr,
-		&sensor_dev_attr_fan2_fault.dev_attr.attr,
-		&sensor_dev_attr_fan2_alarm.dev_attr.attr,
-		&sensor_dev_attr_pwm2_enable.dev_attr.attr,
-		&sensor_dev_attr_pwm2.dev_attr.attr,
-		&sensor_dev_attr_pwm2_min.dev_attr.attr,
-		&sensor_dev_attr_pwm2_max.dev_attr.attr,
-
-		&sensor_dev_attr_fan3_input.dev_attr.attr,
-		&sensor_dev_attr_fan3_target.dev_attr.attr,
-		&sensor_dev_attr_fan3_fault.dev_attr.attr,
-		&sensor_dev_attr_fan3_alarm.dev_attr.attr,
-		&sensor_dev_attr_pwm3_enable.dev_attr.attr,
-		&sensor_dev_attr_pwm3.dev_attr.attr,
-		&sensor_dev_attr_pwm3_min.dev_attr.attr,
-		&sensor_dev_attr_pwm3_max.dev_attr.attr,
-
-		&sensor_dev_attr_fan4_input.dev_attr.attr,
-		&sensor_dev_attr_fan4_target.dev_attr.attr,
-		&sensor_dev_attr_fan4_fault.dev_attr.attr,
-		&sensor_dev_attr_fan4_alarm.dev_attr.attr,
-		&sensor_dev_attr_pwm4_enable.dev_attr.attr,
-		&sensor_dev_attr_pwm4.dev_attr.attr,
-		&sensor_dev_attr_pwm4_min.dev_attr.attr,
-		&sensor_dev_attr_pwm4_max.dev_attr.attr,
-
-		NULL,
-	};
+static umode_t fw_hwmon_is_visible(const void *drvdata,
+				   enum hwmon_sensor_types type, u32 attr,
+				   int channel)
+{
+	const struct framework_data *data = drvdata;
 
-static const struct attribute_group fw_fans_group = {
-	.attrs = fw_fans_attrs,
-};
+	switch (type) {
+	case hwmon_fan:
+		if (channel >= data->fan_count)
+			return 0;
+
+		/* Target RPM can only be read back from fan 0 */
+		if (attr == hwmon_fan_target)
+			return channel == 0 ? 0644 : 0200;
+
+		return 0444;
+
+	case hwmon_pwm:
+		if (channel >= data->fan_count)
+			return 0;
+
+		/* The EC can't tell us the duty cycle */
+		if (attr == hwmon_pwm_input)
+			return 0200;
+
+		return 0644;
+
+	case hwmon_temp:
+		if (!(data->temp_present & BIT(channel)))
+			return 0;
+
+		if (attr == hwmon_temp_label && !data->temp_labels[channel])
+			return 0;
+
+		return 0444;
+
+	case hwmon_intrusion:
+		/* Chassis Intrusion can be cleared, Chassis Open can't */
+		return channel == 0 ? 0644 : 0444;
+
+	default:
+		return 0;
+	}
+}
 
-/* Other HWMON Sensors */
 /* clang-format off */
-static SENSOR_DEVICE_ATTR_RW(intrusion0_alarm, fw_intrusion, 0); /* Chassis Intrusion */
-static SENSOR_DEVICE_ATTR_RO(intrusion1_alarm, fw_intrusion, 1); /* Chassis Open */
+#define FW_HWMON_FAN \
+	(HWMON_F_INPUT | HWMON_F_TARGET | HWMON_F_FAULT | HWMON_F_ALARM)
+#define FW_HWMON_PWM \
+	(HWMON_PWM_INPUT | HWMON_PWM_ENABLE | HWMON_PWM_AUTO_CHANNELS_TEMP)
+#define FW_HWMON_TEMP (HWMON_T_INPUT | HWMON_T_LABEL)
+
+static const struct hwmon_channel_info *const fw_hwmon_info[] = {
+	HWMON_CHANNEL_INFO(fan,
+			   FW_HWMON_FAN, FW_HWMON_FAN,
+			   FW_HWMON_FAN, FW_HWMON_FAN),
+	HWMON_CHANNEL_INFO(pwm,
+			   FW_HWMON_PWM, FW_HWMON_PWM,
+			   FW_HWMON_PWM, FW_HWMON_PWM),
+	HWMON_CHANNEL_INFO(temp,
+			   FW_HWMON_TEMP, FW_HWMON_TEMP, FW_HWMON_TEMP,
+			   FW_HWMON_TEMP, FW_HWMON_TEMP, FW_HWMON_TEMP,
+			   FW_HWMON_TEMP, FW_HWMON_TEMP, FW_HWMON_TEMP,
+			   FW_HWMON_TEMP, FW_HWMON_TEMP, FW_HWMON_TEMP,
+			   FW_HWMON_TEMP, FW_HWMON_TEMP, FW_HWMON_TEMP,
+			   FW_HWMON_TEMP, FW_HWMON_TEMP, FW_HWMON_TEMP,
+			   FW_HWMON_TEMP, FW_HWMON_TEMP, FW_HWMON_TEMP,
+			   FW_HWMON_TEMP, FW_HWMON_TEMP, FW_HWMON_TEMP),
+	HWMON_CHANNEL_INFO(intrusion,
+			   HWMON_INTRUSION_ALARM, /* Chassis Intrusion */
+			   HWMON_INTRUSION_ALARM), /* Chassis Open */
+	NULL,
+};
 /* clang-format on */
 
-static struct attribute *fw_hwmon_attrs[] = {
-	&sensor_dev_attr_intrusion0_alarm.dev_attr.attr,
-	&sensor_dev_attr_intrusion1_alarm.dev_attr.attr,
-	NULL,
+static const struct hwmon_ops fw_hwmon_ops = {
+	.is_visible = fw_hwmon_is_visible,
+	.read = fw_hwmon_read,
+	.read_string = fw_hwmon_read_string,
+	.write = fw_hwmon_write,
 };
 
-static const struct attribute_group fw_hwmon_group = {
-	.attrs = fw_hwmon_attrs,
+static const struct hwmon_chip_info fw_hwmon_chip_info = {
+	.ops = &fw_hwmon_ops,
+	.info = fw_hwmon_info,
 };
 
-static const struct attribute_group *fw_hwmon_groups[] = {
-	&fw_fans_group,
-	&fw_hwmon_group,
+/**** pwmN_min / pwmN_max ****/
+/* These aren't part of the hwmon core's pwm attributes */
+static SENSOR_DEVICE_ATTR_RO(pwm1_min, fw_pwm_min, 0);
+static SENSOR_DEVICE_ATTR_RO(pwm1_max, fw_pwm_max, 0);
+static SENSOR_DEVICE_ATTR_RO(pwm2_min, fw_pwm_min, 1);
+static SENSOR_DEVICE_ATTR_RO(pwm2_max, fw_pwm_max, 1);
+static SENSOR_DEVICE_ATTR_RO(pwm3_min, fw_pwm_min, 2);
+static SENSOR_DEVICE_ATTR_RO(pwm3_max, fw_pwm_max, 2);
+static SENSOR_DEVICE_ATTR_RO(pwm4_min, fw_pwm_min, 3);
+static SENSOR_DEVICE_ATTR_RO(pwm4_max, fw_pwm_max, 3);
+
+static struct attribute *fw_pwm_limits_attrs[] = {
+	&sensor_dev_attr_pwm1_min.dev_attr.attr,
+	&sensor_dev_attr_pwm1_max.dev_attr.attr,
+	&sensor_dev_attr_pwm2_min.dev_attr.attr,
+	&sensor_dev_attr_pwm2_max.dev_attr.attr,
+	&sensor_dev_attr_pwm3_min.dev_attr.attr,
+	&sensor_dev_attr_pwm3_max.dev_attr.attr,
+	&sensor_dev_attr_pwm4_min.dev_attr.attr,
+	&sensor_dev_attr_pwm4_max.dev_attr.attr,
 	NULL,
 };
 
+static umode_t fw_pwm_limits_is_visible(struct kobject *kobj,
+					struct attribute *attr, int n)
+{
+	struct framework_data *data = dev_get_drvdata(kobj_to_dev(kobj));
+	struct sensor_device_attribute *sen_attr =
+		to_sensor_dev_attr(container_of(attr, struct device_attribute,
+						attr));
+
+	return sen_attr->index < data->fan_count ? attr->mode : 0;
+}
+
+static const struct attribute_group fw_pwm_limits_group = {
+	.attrs = fw_pwm_limits_attrs,
+	.is_visible = fw_pwm_limits_is_visible,
+};
+
 int fw_hwmon_register(struct framework_data *data)
 {
 	struct device *dev = &data->pdev->dev;
 	struct cros_ec_device *ec = dev_get_drvdata(data->ec_device);
-
-	ec_device = data->ec_device;
+	int ret;
 
 	if (ec->cmd_readmem) {
 		/* Count the number of fans */
-		size_t fan_count;
-		if (ec_count_fans(&fan_count) < 0) {
+		if (ec_count_fans(data, &data->fan_count) < 0) {
 			dev_err(dev, DRV_NAME ": failed to count fans.\n");
 			return -EINVAL;
 		}
-		/* NULL terminates the list after the last detected fan */
-		fw_fans_attrs[fan_count * FW_ATTRS_PER_FAN] = NULL;
 
-		data->hwmon_dev = devm_hwmon_device_register_with_groups(
-			dev, DRV_NAME, NULL, fw_hwmon_groups);
-		if (IS_ERR(data->hwmon_dev))
-			return PTR_ERR(data->hwmon_dev);
+		if (ec_probe_temp_sensors(data) < 0)
+			dev_warn(dev, DRV_NAME
+				 ": failed to read temperature sensors.\n");
+
+		ret = fw_fan_curve_init(data);
+		if (ret)
+			return ret;
+
+		data->hwmon_groups[0] = &fw_pwm_limits_group;
+		data->hwmon_groups[1] = &data->fan_curve_group;
+
+		data->hwmon_dev = devm_hwmon_device_register_with_info(
+			dev, DRV_NAME, data, &fw_hwmon_chip_info,
+			data->hwmon_groups);
+		if (IS_ERR(data->hwmon_dev)) {
+			ret = PTR_ERR(data->hwmon_dev);
+			/* Events check this before notifying */
+			data->hwmon_dev = NULL;
+			return ret;
+		}
+
+		fw_fan_cooling_register(data);
 
 	} else {
 		dev_err(dev,
 			DRV_NAME
 			": fan readings could not be enabled for this EC %s.\n",
 			FRAMEWORK_LAPTOP_EC_DEVICE_NAME);
+		/* The fan lock isn't set up, so nothing that needs it may run */
+		return -EOPNOTSUPP;
 	}
 
 	return 0;
@@ -542,5 +1168,7 @@ void fw_hwmon_unregister(struct framework_data *data)
 	if (!data->hwmon_dev)
 		return;
 
+	fw_fan_cooling_unregister(data);
 	devm_hwmon_device_unregister(data->hwmon_dev);
+	fw_fan_curve_exit(data);
 }
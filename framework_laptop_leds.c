@@ -14,30 +14,28 @@
 #include <linux/module.h>
 #include <linux/types.h>
 #include <linux/leds.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 #include <linux/platform_device.h>
 #include <linux/platform_data/cros_ec_commands.h>
 #include <linux/platform_data/cros_ec_proto.h>
 
 #include "framework_laptop.h"
 
-static struct device *ec_device;
+static unsigned int kb_poll_ms = 1000;
+module_param(kb_poll_ms, uint, 0444);
+MODULE_PARM_DESC(kb_poll_ms,
+		 "Keyboard backlight poll interval in ms (0 = off)");
 
-/* Get the current keyboard LED brightness */
-static enum led_brightness kb_led_get(struct led_classdev *led)
+/* Read the keyboard LED brightness from the EC */
+static int ec_kb_led_get(struct framework_data *data)
 {
-	struct cros_ec_device *ec;
-
 	int ret;
 
-	if (!ec_device)
-		return -EIO;
-
-	ec = dev_get_drvdata(ec_device);
-
 	struct ec_response_pwm_get_keyboard_backlight resp;
 
-	ret = cros_ec_cmd(ec, 0, EC_CMD_PWM_GET_KEYBOARD_BACKLIGHT, NULL, 0,
-			  &resp, sizeof(resp));
+	ret = fw_ec_cmd_shared(data, 0, EC_CMD_PWM_GET_KEYBOARD_BACKLIGHT, NULL,
+			       0, &resp, sizeof(resp));
 	if (ret < 0) {
 		return -EIO;
 	}
@@ -45,24 +43,52 @@ static enum led_brightness kb_led_get(struct led_classdev *led)
 	return resp.percent;
 }
 
-/* Set the keyboard LED brightness */
-static int kb_led_set(struct led_classdev *led, enum led_brightness value)
+/* Get the current keyboard LED brightness, in percent */
+int fw_kb_led_get(struct framework_data *data)
 {
-	struct cros_ec_device *ec;
-
 	int ret;
 
-	if (!ec_device)
-		return -EIO;
+	mutex_lock(&data->kb_lock);
+
+	/* Only ask the EC if we don't know yet */
+	if (data->kb_brightness < 0)
+		data->kb_brightness = ec_kb_led_get(data);
+	ret = data->kb_brightness;
+
+	mutex_unlock(&data->kb_lock);
+
+	return ret;
+}
+
+static enum led_brightness kb_led_get(struct led_classdev *led)
+{
+	struct framework_data *data =
+		container_of(led, struct framework_data, kb_led);
 
-	ec = dev_get_drvdata(ec_device);
+	return fw_kb_led_get(data);
+}
+
+/* Set the keyboard LED brightness, in percent */
+int fw_kb_led_set(struct framework_data *data, unsigned int percent)
+{
+	int ret;
 
 	struct ec_params_pwm_set_keyboard_backlight params = {
-		.percent = value,
+		.percent = percent,
 	};
 
-	ret = cros_ec_cmd(ec, 0, EC_CMD_PWM_SET_KEYBOARD_BACKLIGHT, &params,
-			  sizeof(params), NULL, 0);
+	if (percent > 100)
+		return -EINVAL;
+
+	mutex_lock(&data->kb_lock);
+
+	ret = fw_ec_cmd(data, 0, EC_CMD_PWM_SET_KEYBOARD_BACKLIGHT, &params,
+			sizeof(params), NULL, 0);
+	/* Leave it unknown if the EC didn't take it */
+	data->kb_brightness = ret < 0 ? -EIO : percent;
+
+	mutex_unlock(&data->kb_lock);
+
 	if (ret < 0) {
 		return -EIO;
 	}
@@ -70,6 +96,45 @@ static int kb_led_set(struct led_classdev *led, enum led_brightness value)
 	return 0;
 }
 
+static int kb_led_set(struct led_classdev *led, enum led_brightness value)
+{
+	struct framework_data *data =
+		container_of(led, struct framework_data, kb_led);
+
+	return fw_kb_led_set(data, value);
+}
+
+/* Re-read the keyboard backlight after the EC may have changed it */
+void fw_kb_led_refresh(struct framework_data *data)
+{
+	int ret;
+	bool changed;
+
+	mutex_lock(&data->kb_lock);
+
+	ret = ec_kb_led_get(data);
+	changed = ret >= 0 && ret != data->kb_brightness;
+	data->kb_brightness = ret;
+
+	mutex_unlock(&data->kb_lock);
+
+	if (changed)
+		led_classdev_notify_brightness_hw_changed(&data->kb_led, ret);
+}
+
+/* Fallback for when the EC can't send events */
+static void kb_led_poll_work(struct work_struct *work)
+{
+	struct framework_data *data =
+		container_of(to_delayed_work(work), struct framework_data,
+			     kb_poll_work);
+
+	fw_kb_led_refresh(data);
+
+	schedule_delayed_work(&data->kb_poll_work,
+			      msecs_to_jiffies(kb_poll_ms));
+}
+
 #define EC_CMD_FP_LED_LEVEL_CONTROL 0x3E0E
 
 struct ec_params_fp_led_control {
@@ -90,7 +155,8 @@ struct ec_response_fp_led_level {
 /* Get the fingerprint LED brightness */
 static enum led_brightness fp_led_get(struct led_classdev *led)
 {
-	struct cros_ec_device *ec;
+	struct framework_data *data =
+		container_of(led, struct framework_data, fp_led);
 	int ret;
 
 	struct ec_params_fp_led_control params = {
@@ -100,13 +166,8 @@ static enum led_brightness fp_led_get(struct led_classdev *led)
 
 	struct ec_response_fp_led_level resp;
 
-	if (!ec_device)
-		goto out;
-
-	ec = dev_get_drvdata(ec_device);
-
-	ret = cros_ec_cmd(ec, 0, EC_CMD_FP_LED_LEVEL_CONTROL, &params,
-			  sizeof(params), &resp, sizeof(resp));
+	ret = fw_ec_cmd_shared(data, 0, EC_CMD_FP_LED_LEVEL_CONTROL, &params,
+			       sizeof(params), &resp, sizeof(resp));
 
 	if (ret < 0) {
 		goto out;
@@ -118,26 +179,23 @@ out:
 	return 0;
 }
 
-/* Set the fingerprint LED brightness */
-static int fp_led_set(struct led_classdev *led, enum led_brightness value)
+/* Set the fingerprint LED brightness, 0 is low and 2 is high */
+int fw_fp_led_set(struct framework_data *data, unsigned int level)
 {
-	struct cros_ec_device *ec;
 	int ret;
 
 	struct ec_params_fp_led_control params = {
-		.set_led_level = FP_LED_BRIGHTNESS_LOW - value,
+		.set_led_level = FP_LED_BRIGHTNESS_LOW - level,
 		.get_led_level = 0,
 	};
 
 	struct ec_response_fp_led_level resp;
 
-	if (!ec_device)
-		return -EIO;
-
-	ec = dev_get_drvdata(ec_device);
+	if (level > FP_LED_BRIGHTNESS_LOW)
+		return -EINVAL;
 
-	ret = cros_ec_cmd(ec, 0, EC_CMD_FP_LED_LEVEL_CONTROL, &params,
-			  sizeof(params), &resp, sizeof(resp));
+	ret = fw_ec_cmd(data, 0, EC_CMD_FP_LED_LEVEL_CONTROL, &params,
+			sizeof(params), &resp, sizeof(resp));
 	if (ret < 0) {
 		return -EIO;
 	}
@@ -145,23 +203,39 @@ static int fp_led_set(struct led_classdev *led, enum led_brightness value)
 	return 0;
 }
 
+static int fp_led_set(struct led_classdev *led, enum led_brightness value)
+{
+	struct framework_data *data =
+		container_of(led, struct framework_data, fp_led);
+
+	return fw_fp_led_set(data, value);
+}
+
 int fw_leds_register(struct framework_data *data)
 {
 	int ret;
 
 	struct device *dev = &data->pdev->dev;
-	
-	ec_device = data->ec_device;
+
+	mutex_init(&data->kb_lock);
+	data->kb_brightness = -EIO;
+	INIT_DELAYED_WORK(&data->kb_poll_work, kb_led_poll_work);
 
 	data->kb_led.name = DRV_NAME "::kbd_backlight";
 	data->kb_led.brightness_get = kb_led_get;
 	data->kb_led.brightness_set_blocking = kb_led_set;
 	data->kb_led.max_brightness = 100;
+	data->kb_led.flags = LED_BRIGHT_HW_CHANGED;
 
 	ret = devm_led_classdev_register(dev, &data->kb_led);
 	if (ret)
 		goto kb_error;
 
+	/* Without EC events, polling is the only way to see Fn key changes */
+	if (kb_poll_ms && !fw_events_supported(data))
+		schedule_delayed_work(&data->kb_poll_work,
+				      msecs_to_jiffies(kb_poll_ms));
+
 	/* "fingerprint" is a non-standard name, but this behaves weird anyway */
 	data->fp_led.name = DRV_NAME "::fingerprint";
 	data->fp_led.brightness_get = fp_led_get;
@@ -175,6 +249,7 @@ int fw_leds_register(struct framework_data *data)
 	return 0;
 
 fp_error:
+	cancel_delayed_work_sync(&data->kb_poll_work);
 	devm_led_classdev_unregister(dev, &data->fp_led);
 kb_error:
 	devm_led_classdev_unregister(dev, &data->kb_led);
@@ -185,6 +260,7 @@ kb_error:
 void fw_leds_unregister(struct framework_data *data)
 {
 	struct device *dev = &data->pdev->dev;
+	cancel_delayed_work_sync(&data->kb_poll_work);
 	devm_led_classdev_unregister(dev, &data->fp_led);
 	devm_led_classdev_unregister(dev, &data->kb_led);
 }
\ No newline at end of file
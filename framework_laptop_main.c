@@ -12,6 +12,9 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/types.h>
+#include <linux/async.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
 #include <linux/leds.h>
 #include <linux/sysfs.h>
 #include <linux/dmi.h>
@@ -57,11 +60,96 @@ static int device_match_cros_ec(struct device *dev, const void *data)
 	return !strncmp(name, "cros-ec-dev", 11);
 }
 
+struct fw_probe_stage {
+	const char *name;
+	int (*reg)(struct framework_data *data);
+	void (*unreg)(struct framework_data *data);
+	/* Only needs the EC, so it's registered alongside the others */
+	bool parallel;
+	/* Stages it uses, it's skipped if any of them failed */
+	unsigned long needs;
+};
+
+static const struct fw_probe_stage fw_probe_stages[FW_PROBE_COUNT] = {
+	[FW_PROBE_BATTERY] = { "battery", fw_battery_register,
+			       fw_battery_unregister, true },
+	[FW_PROBE_LEDS] = { "LEDs", fw_leds_register, fw_leds_unregister,
+			    true },
+	[FW_PROBE_COLOR_LEDS] = { "indicator LED", fw_color_leds_register,
+				  fw_color_leds_unregister, true },
+	[FW_PROBE_HWMON] = { "hwmon", fw_hwmon_register, fw_hwmon_unregister,
+			     true },
+	[FW_PROBE_PRIVACY] = { "privacy switches", fw_privacy_register,
+			       fw_privacy_unregister, true },
+	[FW_PROBE_ENERGY] = { "powercap zone", fw_energy_register,
+			      fw_energy_unregister },
+	/* The fans and sensors all come from hwmon */
+	[FW_PROBE_PMU] = { "perf PMU", fw_pmu_register, fw_pmu_unregister,
+			   false, BIT(FW_PROBE_HWMON) },
+	[FW_PROBE_METRICS] = { "metrics", fw_metrics_register },
+	/* Batches and telemetry go to the fans */
+	[FW_PROBE_CDEV] = { "character device", fw_cdev_register,
+			    fw_cdev_unregister, false, BIT(FW_PROBE_HWMON) },
+	/* So do the presets */
+	[FW_PROBE_PROFILE] = { "platform profile", fw_profile_register,
+			       fw_profile_unregister, false,
+			       BIT(FW_PROBE_HWMON) },
+	[FW_PROBE_EVENTS] = { "EC events", fw_events_register,
+			      fw_events_unregister },
+};
+
+struct fw_probe_job {
+	struct framework_data *data;
+	const struct fw_probe_stage *stage;
+	int ret;
+};
+
+static ASYNC_DOMAIN_EXCLUSIVE(fw_probe_domain);
+
+static void fw_probe_async(void *arg, async_cookie_t cookie)
+{
+	struct fw_probe_job *job = arg;
+
+	job->ret = job->stage->reg(job->data);
+}
+
+/* Record how a stage went, a failed one isn't unregistered later */
+static void fw_probe_result(struct framework_data *data,
+			    struct fw_probe_job *job, unsigned long *failed)
+{
+	int id = job->stage - fw_probe_stages;
+
+	if (!job->ret) {
+		__set_bit(id, &data->probed);
+		return;
+	}
+
+	__set_bit(id, failed);
+	dev_warn(&data->pdev->dev, DRV_NAME ": failed to register %s (%d).\n",
+		 job->stage->name, job->ret);
+}
+
+/*
+ * devm runs this after remove() and after every devm consumer of the EC,
+ * e.g. the hwmon and LED devices, so nothing can reach the EC afterwards.
+ */
+static void fw_ec_release(void *arg)
+{
+	struct framework_data *data = arg;
+
+	fw_ec_unregister(data);
+	put_device(data->ec_device);
+}
+
 static int framework_probe(struct platform_device *pdev)
 {
+	struct fw_probe_job jobs[FW_PROBE_COUNT];
+	unsigned long failed = 0;
 	struct device *dev;
 	struct framework_data *data;
 	struct device *ec_device;
+	ktime_t start = ktime_get();
+	int ret;
 
 	dev = &pdev->dev;
 
@@ -75,19 +163,74 @@ static int framework_probe(struct platform_device *pdev)
 	ec_device = get_device(ec_device->parent);
 
 	data = devm_kzalloc(dev, sizeof(*data), GFP_KERNEL);
-	if (!data)
+	if (!data) {
+		put_device(ec_device);
 		return -ENOMEM;
+	}
 
 	platform_set_drvdata(pdev, data);
 	data->pdev = pdev;
 	data->ec_device = ec_device;
+	/* Named after the device, so a second one gets its own */
+	data->debugfs = debugfs_create_dir(dev_name(dev), NULL);
+
+	ret = fw_ec_register(data);
+	if (ret) {
+		fw_ec_release(data);
+		goto err_debugfs;
+	}
+
+	ret = devm_add_action_or_reset(dev, fw_ec_release, data);
+	if (ret)
+		goto err_debugfs;
+
+	ret = fw_setpoint_register(data);
+	if (ret)
+		goto err_debugfs;
+
+	for (int i = 0; i < FW_PROBE_COUNT; i++) {
+		jobs[i].data = data;
+		jobs[i].stage = &fw_probe_stages[i];
+		jobs[i].ret = 0;
+	}
 
-	fw_battery_register(data);
-	fw_leds_register(data);
-	fw_color_leds_register(data);
-	fw_hwmon_register(data);
+	/* Each of these waits on EC round trips, so overlap them */
+	for (int i = 0; i < FW_PROBE_COUNT; i++) {
+		if (fw_probe_stages[i].parallel)
+			async_schedule_domain(fw_probe_async, &jobs[i],
+					      &fw_probe_domain);
+	}
+	async_synchronize_full_domain(&fw_probe_domain);
+
+	for (int i = 0; i < FW_PROBE_COUNT; i++) {
+		const struct fw_probe_stage *stage = &fw_probe_stages[i];
+
+		if (!stage->parallel) {
+			if (stage->needs & failed) {
+				dev_warn(dev, DRV_NAME
+					 ": skipping %s, it needs one that failed.\n",
+					 stage->name);
+				__set_bit(i, &failed);
+				continue;
+			}
+
+			jobs[i].ret = stage->reg(data);
+		}
+
+		fw_probe_result(data, &jobs[i], &failed);
+	}
+
+	data->probe_us = ktime_us_delta(ktime_get(), start);
+	debugfs_create_u64("probe_us", 0444, data->debugfs, &data->probe_us);
+	dev_dbg(dev, DRV_NAME ": probed in %llu us.\n", data->probe_us);
 
 	return 0;
+
+err_debugfs:
+	debugfs_remove_recursive(data->debugfs);
+	dev_err(dev, DRV_NAME ": failed to set up the EC (%d).\n", ret);
+
+	return ret;
 }
 
 static int framework_remove(struct platform_device *pdev)
@@ -100,13 +243,18 @@ static int framework_remove(struct platform_device *pdev)
 
 	/* Make sure they're not null before we try to unregister it */
 	if (data) {
-		fw_hwmon_unregister(data);
-		fw_color_leds_unregister(data);
-		fw_leds_unregister(data);
-		fw_battery_unregister(data);
+		/* In reverse, and only what registered */
+		for (int i = FW_PROBE_COUNT - 1; i >= 0; i--) {
+			if (test_bit(i, &data->probed) &&
+			    fw_probe_stages[i].unreg)
+				fw_probe_stages[i].unreg(data);
+		}
+		/* Nothing queues writes now, send the last ones */
+		fw_setpoint_unregister(data);
+		debugfs_remove_recursive(data->debugfs);
 	}
 
-	put_device(data->ec_device);
+	/* The EC goes last, in fw_ec_release() */
 
 	return 0;
 }
@@ -116,16 +264,22 @@ static struct platform_driver framework_driver = {
 		.name = DRV_NAME,
 		.acpi_match_table = device_ids,
 		.dev_groups = framework_laptop_groups,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe = framework_probe,
 	.remove = framework_remove,
 };
 
+static bool force;
+module_param(force, bool, 0444);
+MODULE_PARM_DESC(force,
+		 "Load on systems that aren't a Framework Laptop, e.g. with the EC simulator");
+
 static int __init framework_laptop_init(void)
 {
 	int ret;
 
-	if (!dmi_check_system(framework_laptop_dmi_table)) {
+	if (!force && !dmi_check_system(framework_laptop_dmi_table)) {
 		pr_err(DRV_NAME ": unsupported system.\n");
 		return -ENODEV;
 	}
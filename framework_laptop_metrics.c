@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/debugfs.h>
+#include <linux/leds.h>
+#include <linux/seq_file.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+
+/* Big enough that seq_file never has to call show() again */
+#define FW_METRICS_BUF_SIZE (16 * 1024)
+
+static void fw_metric_family(struct seq_file *s, const char *name,
+			     const char *type, const char *help)
+{
+	seq_printf(s, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+/* Print val / div with as many decimals as div has zeroes */
+static void fw_metric_fixed(struct seq_file *s, s64 val, u32 div)
+{
+	u64 mag = val < 0 ? -val : val;
+	u32 rem;
+	u64 whole = div_u64_rem(mag, div, &rem);
+
+	seq_printf(s, " %s%llu.%0*u\n", val < 0 ? "-" : "", whole,
+		   div == 1000 ? 3 : 6, rem);
+}
+
+/* Label values need backslashes, quotes and newlines escaped */
+static void fw_metric_label(struct seq_file *s, const char *val)
+{
+	for (; *val; val++) {
+		if (*val == '\n') {
+			seq_puts(s, "\\n");
+			continue;
+		}
+
+		if (*val == '\\' || *val == '"')
+			seq_putc(s, '\\');
+		seq_putc(s, *val);
+	}
+}
+
+/* Everything from the memory map, in one read */
+static void fw_metrics_memmap(struct seq_file *s, struct framework_data *data)
+{
+	u8 raw[FW_MEMMAP_SNAPSHOT_SIZE];
+	u32 voltage, rate, capacity;
+	s64 current_ma;
+	long temp;
+	u8 flags;
+
+	if (fw_ec_memmap_snapshot(data, raw) < 0)
+		return;
+
+	fw_metric_family(s, "framework_laptop_fan_rpm", "gauge",
+			 "Fan speed, 0 if stalled.");
+	for (int i = 0; i < data->fan_count; i++)
+		seq_printf(s, "framework_laptop_fan_rpm{fan=\"%d\"} %ld\n",
+			   i + 1, fw_memmap_fan_rpm(raw, i));
+
+	fw_metric_family(s, "framework_laptop_temperature_celsius", "gauge",
+			 "Temperature sensor reading.");
+	for (int i = 0; i < FW_TEMP_SENSOR_ENTRIES; i++) {
+		if (!(data->temp_present & BIT(i)) ||
+		    fw_memmap_temp(raw, i, &temp) < 0)
+			continue;
+
+		seq_printf(s,
+			   "framework_laptop_temperature_celsius{sensor=\"%d\",label=\"",
+			   i + 1);
+		fw_metric_label(s, data->temp_labels[i] ?: "");
+		seq_puts(s, "\"}");
+		fw_metric_fixed(s, temp, 1000);
+	}
+
+	flags = raw[EC_MEMMAP_BATT_FLAG];
+	if (!(flags & EC_BATT_FLAG_BATT_PRESENT))
+		return;
+
+	memcpy(&voltage, raw + EC_MEMMAP_BATT_VOLT, sizeof(voltage));
+	memcpy(&rate, raw + EC_MEMMAP_BATT_RATE, sizeof(rate));
+	memcpy(&capacity, raw + EC_MEMMAP_BATT_CAP, sizeof(capacity));
+	current_ma = flags & EC_BATT_FLAG_DISCHARGING ? -(s64)rate : rate;
+
+	fw_metric_family(s, "framework_laptop_battery_voltage_volts", "gauge",
+			 "Battery voltage.");
+	seq_puts(s, "framework_laptop_battery_voltage_volts");
+	fw_metric_fixed(s, voltage, 1000);
+
+	fw_metric_family(s, "framework_laptop_battery_current_amperes",
+			 "gauge",
+			 "Battery current, negative while discharging.");
+	seq_puts(s, "framework_laptop_battery_current_amperes");
+	fw_metric_fixed(s, current_ma, 1000);
+
+	fw_metric_family(s, "framework_laptop_battery_charge_ampere_hours",
+			 "gauge", "Remaining battery charge.");
+	seq_puts(s, "framework_laptop_battery_charge_ampere_hours");
+	fw_metric_fixed(s, capacity, 1000);
+}
+
+/* One command each, skipped if it fails */
+static void fw_metrics_commands(struct seq_file *s,
+				struct framework_data *data)
+{
+	bool microphone, camera;
+	u32 rpm;
+	long val;
+	int ret;
+
+	if (data->fan_count && !fw_fan_get_target(data, &rpm)) {
+		fw_metric_family(s, "framework_laptop_fan_target_rpm", "gauge",
+				 "Target speed of the first fan.");
+		seq_printf(s, "framework_laptop_fan_target_rpm{fan=\"1\"} %u\n",
+			   rpm);
+	}
+
+	fw_metric_family(s, "framework_laptop_fan_mode", "gauge",
+			 "Fan control mode, same as pwmN_enable.");
+	for (int i = 0; i < data->fan_count; i++)
+		seq_printf(s, "framework_laptop_fan_mode{fan=\"%d\"} %d\n",
+			   i + 1, READ_ONCE(data->fan_curve[i].mode));
+
+	fw_metric_family(s, "framework_laptop_chassis_intrusion", "gauge",
+			 "Whether the chassis was opened, and whether it's open now.");
+	if (!fw_intrusion_get(data, 0, &val))
+		seq_printf(s, "framework_laptop_chassis_intrusion{state=\"ever_opened\"} %ld\n",
+			   val);
+	if (!fw_intrusion_get(data, 1, &val))
+		seq_printf(s, "framework_laptop_chassis_intrusion{state=\"open\"} %ld\n",
+			   val);
+
+	ret = fw_battery_get_limit(data);
+	if (ret >= 0) {
+		fw_metric_family(s, "framework_laptop_charge_limit_percent",
+				 "gauge", "Battery charge limit.");
+		seq_printf(s, "framework_laptop_charge_limit_percent %d\n",
+			   ret);
+	}
+
+	if (!fw_privacy_get(data, &microphone, &camera)) {
+		fw_metric_family(s, "framework_laptop_privacy_enabled",
+				 "gauge",
+				 "Whether the privacy switch lets the device through.");
+		seq_printf(s, "framework_laptop_privacy_enabled{device=\"microphone\"} %d\n",
+			   microphone);
+		seq_printf(s, "framework_laptop_privacy_enabled{device=\"camera\"} %d\n",
+			   camera);
+	}
+
+	fw_metric_family(s, "framework_laptop_led_brightness", "gauge",
+			 "LED brightness, same as the LED class brightness.");
+	if (data->kb_led.brightness_get) {
+		ret = data->kb_led.brightness_get(&data->kb_led);
+		if (ret >= 0)
+			seq_printf(s, "framework_laptop_led_brightness{led=\"kbd_backlight\"} %d\n",
+				   ret);
+	}
+	if (data->fp_led.brightness_get)
+		seq_printf(s, "framework_laptop_led_brightness{led=\"fingerprint\"} %d\n",
+			   data->fp_led.brightness_get(&data->fp_led));
+	if (data->batt_led.num_colors)
+		seq_printf(s, "framework_laptop_led_brightness{led=\"indicator\"} %u\n",
+			   READ_ONCE(data->batt_led.led_cdev.brightness));
+}
+
+static int fw_metrics_show(struct seq_file *s, void *unused)
+{
+	struct framework_data *data = s->private;
+
+	fw_metrics_memmap(s, data);
+	fw_metrics_commands(s, data);
+
+	fw_metric_family(s, "framework_laptop_energy_joules", "counter",
+			 "Energy drawn from the battery since the driver loaded.");
+	seq_puts(s, "framework_laptop_energy_joules_total");
+	fw_metric_fixed(s, fw_energy_uj(data), 1000000);
+
+	seq_puts(s, "# EOF\n");
+
+	return 0;
+}
+
+static int fw_metrics_open(struct inode *inode, struct file *file)
+{
+	return single_open_size(file, fw_metrics_show, inode->i_private,
+				FW_METRICS_BUF_SIZE);
+}
+
+static const struct file_operations fw_metrics_fops = {
+	.owner = THIS_MODULE,
+	.open = fw_metrics_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int fw_metrics_register(struct framework_data *data)
+{
+	debugfs_create_file("metrics", 0444, data->debugfs, data,
+			    &fw_metrics_fops);
+
+	return 0;
+}
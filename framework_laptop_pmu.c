@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/cpumask.h>
+#include <linux/perf_event.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+
+static unsigned int pmu_ms = 100;
+module_param(pmu_ms, uint, 0644);
+MODULE_PARM_DESC(pmu_ms,
+		 "How often perf events are sampled while in use, in ms (min 10)");
+
+/* Event numbers, in config:0-7 */
+#define FW_PMU_FAN(i) (0x00 + (i))
+#define FW_PMU_TEMP(i) (0x10 + (i))
+#define FW_PMU_BATTERY_POWER 0x40
+#define FW_PMU_ENERGY 0x41
+
+/* Each temperature has a .unit and .scale, and so do power and energy */
+#define FW_PMU_MAX_ATTRS \
+	(EC_FAN_SPEED_ENTRIES + 3 * FW_TEMP_SENSOR_ENTRIES + 2 * 3 + 1)
+
+static struct framework_data *to_fw_data(struct pmu *pmu)
+{
+	return container_of(pmu, struct framework_data, pmu.pmu);
+}
+
+static bool fw_pmu_config_valid(struct framework_data *data, u64 config)
+{
+	if (config < FW_PMU_FAN(EC_FAN_SPEED_ENTRIES))
+		return config - FW_PMU_FAN(0) < data->fan_count;
+
+	if (config >= FW_PMU_TEMP(0) &&
+	    config < FW_PMU_TEMP(FW_TEMP_SENSOR_ENTRIES))
+		return data->temp_present & BIT(config - FW_PMU_TEMP(0));
+
+	return config == FW_PMU_BATTERY_POWER || config == FW_PMU_ENERGY;
+}
+
+/* One EC access covers every event */
+static int fw_pmu_sample(struct framework_data *data)
+{
+	struct fw_pmu *fp = &data->pmu;
+	u8 raw[FW_MEMMAP_SNAPSHOT_SIZE];
+	u64 energy_uj = fw_energy_uj(data);
+	unsigned long flags;
+	int ret;
+
+	ret = fw_ec_memmap_snapshot(data, raw);
+
+	raw_spin_lock_irqsave(&fp->lock, flags);
+	if (!ret)
+		memcpy(fp->raw, raw, sizeof(fp->raw));
+	fp->energy_uj = energy_uj;
+	raw_spin_unlock_irqrestore(&fp->lock, flags);
+
+	return ret;
+}
+
+static void fw_pmu_work(struct work_struct *work)
+{
+	struct fw_pmu *fp =
+		container_of(to_delayed_work(work), struct fw_pmu, work);
+	struct framework_data *data =
+		container_of(fp, struct framework_data, pmu);
+
+	fw_pmu_sample(data);
+
+	/* Stops once the last event is stopped */
+	if (atomic_read(&fp->active))
+		queue_delayed_work(system_wq, &fp->work,
+				   msecs_to_jiffies(max(pmu_ms, 10U)));
+}
+
+/* From the last sample, perf calls this with interrupts off */
+static u64 fw_pmu_value(struct framework_data *data, u64 config)
+{
+	struct fw_pmu *fp = &data->pmu;
+	unsigned long flags;
+	long val = 0;
+	u64 ret;
+
+	raw_spin_lock_irqsave(&fp->lock, flags);
+
+	if (config == FW_PMU_ENERGY)
+		ret = fp->energy_uj;
+	else if (config == FW_PMU_BATTERY_POWER)
+		ret = fw_energy_power_uw(fp->raw);
+	else if (config >= FW_PMU_TEMP(0))
+		ret = fw_memmap_temp(fp->raw, config - FW_PMU_TEMP(0), &val) ?
+			      0 : val;
+	else
+		ret = fw_memmap_fan_rpm(fp->raw, config - FW_PMU_FAN(0));
+
+	raw_spin_unlock_irqrestore(&fp->lock, flags);
+
+	return ret;
+}
+
+/* Energy counts up, everything else reads as its latest value */
+static void fw_pmu_update(struct perf_event *event)
+{
+	struct framework_data *data = to_fw_data(event->pmu);
+	u64 config = event->attr.config;
+	u64 now = fw_pmu_value(data, config);
+	u64 prev;
+
+	if (config != FW_PMU_ENERGY) {
+		local64_set(&event->count, now);
+		return;
+	}
+
+	prev = local64_xchg(&event->hw.prev_count, now);
+	local64_add(now - prev, &event->count);
+}
+
+static int fw_pmu_event_init(struct perf_event *event)
+{
+	struct framework_data *data = to_fw_data(event->pmu);
+
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+
+	/* The values are system wide and there's no interrupt to sample on */
+	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK)
+		return -EINVAL;
+
+	if (event->cpu < 0)
+		return -EINVAL;
+
+	if (!fw_pmu_config_valid(data, event->attr.config))
+		return -EINVAL;
+
+	/* Can sleep here, so start with fresh values */
+	if (!atomic_read(&data->pmu.active))
+		fw_pmu_sample(data);
+
+	return 0;
+}
+
+static void fw_pmu_start(struct perf_event *event, int flags)
+{
+	struct framework_data *data = to_fw_data(event->pmu);
+	struct fw_pmu *fp = &data->pmu;
+
+	event->hw.state = 0;
+	local64_set(&event->hw.prev_count,
+		    fw_pmu_value(data, event->attr.config));
+
+	if (atomic_inc_return(&fp->active) == 1)
+		queue_delayed_work(system_wq, &fp->work,
+				   msecs_to_jiffies(max(pmu_ms, 10U)));
+}
+
+static void fw_pmu_stop(struct perf_event *event, int flags)
+{
+	struct framework_data *data = to_fw_data(event->pmu);
+
+	if (event->hw.state & PERF_HES_STOPPED)
+		return;
+
+	if (flags & PERF_EF_UPDATE)
+		fw_pmu_update(event);
+
+	event->hw.state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+	atomic_dec(&data->pmu.active);
+}
+
+static int fw_pmu_add(struct perf_event *event, int flags)
+{
+	event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+
+	if (flags & PERF_EF_START)
+		fw_pmu_start(event, PERF_EF_RELOAD);
+
+	return 0;
+}
+
+static void fw_pmu_del(struct perf_event *event, int flags)
+{
+	fw_pmu_stop(event, PERF_EF_UPDATE);
+}
+
+static void fw_pmu_read(struct perf_event *event)
+{
+	fw_pmu_update(event);
+}
+
+/**** sysfs ****/
+PMU_FORMAT_ATTR(event, "config:0-7");
+
+static struct attribute *fw_pmu_format_attrs[] = {
+	&format_attr_event.attr,
+	NULL,
+};
+
+static const struct attribute_group fw_pmu_format_group = {
+	.name = "format",
+	.attrs = fw_pmu_format_attrs,
+};
+
+/* Tells perf to open the events once, not on every CPU */
+static ssize_t cpumask_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	return cpumap_print_to_pagebuf(true, buf, cpumask_of(0));
+}
+
+static DEVICE_ATTR_RO(cpumask);
+
+static struct attribute *fw_pmu_cpumask_attrs[] = {
+	&dev_attr_cpumask.attr,
+	NULL,
+};
+
+static const struct attribute_group fw_pmu_cpumask_group = {
+	.attrs = fw_pmu_cpumask_attrs,
+};
+
+static int fw_pmu_add_attr(struct framework_data *data, int *n,
+			   const char *name, const char *str)
+{
+	struct perf_pmu_events_attr *attr;
+
+	if (!name || !str)
+		return -ENOMEM;
+
+	attr = devm_kzalloc(&data->pdev->dev, sizeof(*attr), GFP_KERNEL);
+	if (!attr)
+		return -ENOMEM;
+
+	sysfs_attr_init(&attr->attr.attr);
+	attr->attr.attr.name = name;
+	attr->attr.attr.mode = 0444;
+	attr->attr.show = perf_event_sysfs_show;
+	attr->event_str = str;
+	data->pmu.events[(*n)++] = &attr->attr.attr;
+
+	return 0;
+}
+
+/* Add an event, with a unit and scale if it has them */
+static int fw_pmu_add_event(struct framework_data *data, int *n,
+			    const char *name, u64 config, const char *unit,
+			    const char *scale)
+{
+	struct device *dev = &data->pdev->dev;
+	int ret;
+
+	ret = fw_pmu_add_attr(data, n, name,
+			      devm_kasprintf(dev, GFP_KERNEL, "event=0x%02llx",
+					     config));
+	if (ret || !unit)
+		return ret;
+
+	ret = fw_pmu_add_attr(data, n,
+			      devm_kasprintf(dev, GFP_KERNEL, "%s.unit", name),
+			      unit);
+	if (ret)
+		return ret;
+
+	return fw_pmu_add_attr(data, n,
+			       devm_kasprintf(dev, GFP_KERNEL, "%s.scale",
+					      name),
+			       scale);
+}
+
+/* Only the fans and sensors that are actually there */
+static int fw_pmu_events_init(struct framework_data *data)
+{
+	struct device *dev = &data->pdev->dev;
+	struct fw_pmu *fp = &data->pmu;
+	int ret, n = 0;
+
+	fp->events = devm_kcalloc(dev, FW_PMU_MAX_ATTRS, sizeof(*fp->events),
+				  GFP_KERNEL);
+	if (!fp->events)
+		return -ENOMEM;
+
+	for (int i = 0; i < data->fan_count; i++) {
+		ret = fw_pmu_add_event(data, &n,
+				       devm_kasprintf(dev, GFP_KERNEL, "fan%d",
+						      i + 1),
+				       FW_PMU_FAN(i), NULL, NULL);
+		if (ret)
+			return ret;
+	}
+
+	for (int i = 0; i < FW_TEMP_SENSOR_ENTRIES; i++) {
+		if (!(data->temp_present & BIT(i)))
+			continue;
+
+		ret = fw_pmu_add_event(data, &n,
+				       devm_kasprintf(dev, GFP_KERNEL, "temp%d",
+						      i + 1),
+				       FW_PMU_TEMP(i), "C", "0.001");
+		if (ret)
+			return ret;
+	}
+
+	ret = fw_pmu_add_event(data, &n, "battery_power", FW_PMU_BATTERY_POWER,
+			       "Watts", "1e-6");
+	if (ret)
+		return ret;
+
+	ret = fw_pmu_add_event(data, &n, "energy", FW_PMU_ENERGY, "Joules",
+			       "1e-6");
+	if (ret)
+		return ret;
+
+	fp->events_group.name = "events";
+	fp->events_group.attrs = fp->events;
+
+	fp->groups[0] = &fw_pmu_format_group;
+	fp->groups[1] = &fw_pmu_cpumask_group;
+	fp->groups[2] = &fp->events_group;
+
+	return 0;
+}
+
+int fw_pmu_register(struct framework_data *data)
+{
+	struct fw_pmu *fp = &data->pmu;
+	int ret;
+
+	raw_spin_lock_init(&fp->lock);
+	atomic_set(&fp->active, 0);
+	INIT_DELAYED_WORK(&fp->work, fw_pmu_work);
+
+	ret = fw_pmu_events_init(data);
+	if (ret)
+		return ret;
+
+	fp->pmu = (struct pmu) {
+		.module = THIS_MODULE,
+		.task_ctx_nr = perf_invalid_context,
+		.capabilities = PERF_PMU_CAP_NO_EXCLUDE |
+				PERF_PMU_CAP_NO_INTERRUPT,
+		.attr_groups = fp->groups,
+		.event_init = fw_pmu_event_init,
+		.add = fw_pmu_add,
+		.del = fw_pmu_del,
+		.start = fw_pmu_start,
+		.stop = fw_pmu_stop,
+		.read = fw_pmu_read,
+	};
+
+	ret = perf_pmu_register(&fp->pmu, DRV_NAME, -1);
+	if (ret)
+		return ret;
+
+	fp->registered = true;
+
+	return 0;
+}
+
+void fw_pmu_unregister(struct framework_data *data)
+{
+	struct fw_pmu *fp = &data->pmu;
+
+	if (!fp->registered)
+		return;
+
+	perf_pmu_unregister(&fp->pmu);
+	cancel_delayed_work_sync(&fp->work);
+}
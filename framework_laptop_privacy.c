@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/input.h>
+#include <linux/workqueue.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+
+#define EC_CMD_PRIVACY_SWITCHES_CHECK_MODE 0x3E14
+
+struct ec_response_privacy_switches_check {
+	uint8_t microphone;
+	uint8_t camera;
+} __ec_align1;
+
+static unsigned int privacy_poll_ms = 500;
+module_param(privacy_poll_ms, uint, 0444);
+MODULE_PARM_DESC(privacy_poll_ms,
+		 "Privacy switch poll interval in ms (0 = off)");
+
+/* Bits in privacy_state */
+#define FW_PRIVACY_MIC_MUTED BIT(0)
+#define FW_PRIVACY_CAM_COVERED BIT(1)
+
+static int ec_privacy_get(struct framework_data *data, enum fw_ec_prio prio,
+			  bool *microphone, bool *camera)
+{
+	int ret;
+
+	struct ec_response_privacy_switches_check resp;
+
+	ret = fw_ec_cmd_shared_prio(data, prio, 0,
+				    EC_CMD_PRIVACY_SWITCHES_CHECK_MODE, NULL, 0,
+				    &resp, sizeof(resp));
+	if (ret < 0)
+		return -EIO;
+
+	*microphone = resp.microphone;
+	*camera = resp.camera;
+
+	return 0;
+}
+
+/* Read the privacy switches, true means the device is enabled */
+int fw_privacy_get(struct framework_data *data, bool *microphone, bool *camera)
+{
+	return ec_privacy_get(data, FW_EC_PRIO_BACKGROUND, microphone, camera);
+}
+
+/* Feeds the input device, the desktop's mute indicator waits on it */
+static int ec_privacy_state(struct framework_data *data)
+{
+	bool microphone, camera;
+	int ret;
+
+	ret = ec_privacy_get(data, FW_EC_PRIO_INTERACTIVE, &microphone,
+			     &camera);
+	if (ret < 0)
+		return ret;
+
+	return (microphone ? 0 : FW_PRIVACY_MIC_MUTED) |
+	       (camera ? 0 : FW_PRIVACY_CAM_COVERED);
+}
+
+static void fw_privacy_report(struct framework_data *data, int state)
+{
+	input_report_switch(data->privacy_input, SW_MUTE_DEVICE,
+			    !!(state & FW_PRIVACY_MIC_MUTED));
+	input_report_switch(data->privacy_input, SW_CAMERA_LENS_COVER,
+			    !!(state & FW_PRIVACY_CAM_COVERED));
+	input_sync(data->privacy_input);
+}
+
+/* The EC said the switches changed, it has already debounced them */
+void fw_privacy_refresh(struct framework_data *data)
+{
+	int state;
+
+	if (!data->privacy_input)
+		return;
+
+	state = ec_privacy_state(data);
+	if (state < 0)
+		return;
+
+	data->privacy_state = state;
+	fw_privacy_report(data, state);
+}
+
+/* Fallback for when the EC can't send events */
+static void fw_privacy_poll_work(struct work_struct *work)
+{
+	struct framework_data *data =
+		container_of(to_delayed_work(work), struct framework_data,
+			     privacy_poll_work);
+	int state;
+
+	state = ec_privacy_state(data);
+
+	/* Only report a new state once it has been read twice in a row */
+	if (state >= 0) {
+		if (state == data->privacy_state)
+			fw_privacy_report(data, state);
+		data->privacy_state = state;
+	}
+
+	schedule_delayed_work(&data->privacy_poll_work,
+			      msecs_to_jiffies(privacy_poll_ms));
+}
+
+int fw_privacy_register(struct framework_data *data)
+{
+	struct device *dev = &data->pdev->dev;
+	struct input_dev *input;
+	int state;
+	int ret;
+
+	INIT_DELAYED_WORK(&data->privacy_poll_work, fw_privacy_poll_work);
+
+	/* Older ECs don't have the privacy switch command */
+	state = ec_privacy_state(data);
+	if (state < 0)
+		return state;
+
+	input = devm_input_allocate_device(dev);
+	if (!input)
+		return -ENOMEM;
+
+	input->name = "Framework Laptop Privacy Switches";
+	input->phys = DRV_NAME "/input0";
+	input->id.bustype = BUS_HOST;
+
+	input_set_capability(input, EV_SW, SW_MUTE_DEVICE);
+	input_set_capability(input, EV_SW, SW_CAMERA_LENS_COVER);
+
+	ret = input_register_device(input);
+	if (ret)
+		return ret;
+
+	data->privacy_input = input;
+	data->privacy_state = state;
+	fw_privacy_report(data, state);
+
+	if (privacy_poll_ms && !fw_events_supported(data))
+		schedule_delayed_work(&data->privacy_poll_work,
+				      msecs_to_jiffies(privacy_poll_ms));
+
+	return 0;
+}
+
+void fw_privacy_unregister(struct framework_data *data)
+{
+	cancel_delayed_work_sync(&data->privacy_poll_work);
+}
@@ -0,0 +1,314 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/platform_profile.h>
+#include <linux/platform_device.h>
+#include <linux/version.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+#include "framework_laptop_uapi.h"
+
+/* Indexed by enum fw_profile, -1 leaves the setting alone */
+enum fw_profile {
+	FW_PROFILE_QUIET,
+	FW_PROFILE_BALANCED,
+	FW_PROFILE_PERFORMANCE,
+	FW_PROFILE_COUNT,
+};
+
+/* Only profile_fan_duty, hands the fans back to the EC */
+#define FW_PROFILE_FAN_AUTO -2
+
+static int profile_fan_duty[FW_PROFILE_COUNT] = { -1, -1, -1 };
+module_param_array(profile_fan_duty, int, NULL, 0644);
+MODULE_PARM_DESC(profile_fan_duty,
+		 "Fan duty cycle for the quiet,balanced,performance platform profiles (-1 = leave alone, -2 = EC auto)");
+
+static int profile_kb_brightness[FW_PROFILE_COUNT] = { -1, -1, -1 };
+module_param_array(profile_kb_brightness, int, NULL, 0644);
+MODULE_PARM_DESC(profile_kb_brightness,
+		 "Keyboard backlight percent for the quiet,balanced,performance platform profiles (-1 = leave alone)");
+
+static int profile_charge_limit[FW_PROFILE_COUNT] = { -1, -1, -1 };
+module_param_array(profile_charge_limit, int, NULL, 0644);
+MODULE_PARM_DESC(profile_charge_limit,
+		 "Charge limit percent for the quiet,balanced,performance platform profiles (-1 = leave alone)");
+
+static int fw_profile_index(enum platform_profile_option profile)
+{
+	switch (profile) {
+	case PLATFORM_PROFILE_QUIET:
+		return FW_PROFILE_QUIET;
+	case PLATFORM_PROFILE_BALANCED:
+		return FW_PROFILE_BALANCED;
+	case PLATFORM_PROFILE_PERFORMANCE:
+		return FW_PROFILE_PERFORMANCE;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+/* Everything a preset can change, so a failed one can be undone */
+struct fw_profile_saved {
+	enum fw_fan_mode fan_mode[EC_FAN_SPEED_ENTRIES];
+	long fan_duty[EC_FAN_SPEED_ENTRIES];
+	long fan_rpm[EC_FAN_SPEED_ENTRIES];
+	int kb;
+	int limit;
+};
+
+/* Reading them fails like setting them would, before anything's sent */
+static int fw_profile_save(struct framework_data *data,
+			   const struct fw_batch_op *ops, u32 n,
+			   struct fw_profile_saved *saved)
+{
+	for (u32 i = 0; i < n; i++) {
+		switch (ops[i].type) {
+		case FW_BATCH_CHARGE_LIMIT:
+			saved->limit = fw_battery_get_limit(data);
+			if (saved->limit < 0)
+				return saved->limit;
+			break;
+		case FW_BATCH_KB_BRIGHTNESS:
+			saved->kb = fw_kb_led_get(data);
+			if (saved->kb < 0)
+				return saved->kb;
+			break;
+		default:
+			break;
+		}
+	}
+
+	mutex_lock(&data->fan_lock);
+	for (u8 i = 0; i < data->fan_count; i++) {
+		saved->fan_mode[i] = data->fan_curve[i].mode;
+		saved->fan_duty[i] = data->fan_curve[i].duty;
+		saved->fan_rpm[i] = data->fan_curve[i].rpm;
+	}
+	mutex_unlock(&data->fan_lock);
+
+	return 0;
+}
+
+/* Best effort, a manual fan with nothing known stays where the preset put it */
+static void fw_profile_restore_fan(struct framework_data *data, u8 idx,
+				   const struct fw_profile_saved *saved)
+{
+	if (saved->fan_mode[idx] != FW_FAN_MODE_MANUAL)
+		fw_fan_set_mode(data, idx, saved->fan_mode[idx]);
+	else if (saved->fan_duty[idx] >= 0)
+		fw_fan_set_duty(data, idx, saved->fan_duty[idx]);
+	else if (saved->fan_rpm[idx] >= 0)
+		fw_fan_set_rpm(data, idx, saved->fan_rpm[idx]);
+}
+
+/* Undo every operation that went through */
+static void fw_profile_restore(struct framework_data *data,
+			       const struct fw_batch_op *ops, u32 n,
+			       const struct fw_profile_saved *saved)
+{
+	for (u32 i = 0; i < n; i++) {
+		if (ops[i].result)
+			continue;
+
+		switch (ops[i].type) {
+		case FW_BATCH_CHARGE_LIMIT:
+			fw_battery_set_limit(data, saved->limit);
+			break;
+		case FW_BATCH_KB_BRIGHTNESS:
+			fw_kb_led_set(data, saved->kb);
+			break;
+		default:
+			fw_profile_restore_fan(data, ops[i].index, saved);
+			break;
+		}
+	}
+}
+
+/*
+ * The whole preset goes through one batch, checked before anything's sent.
+ * The charge limit goes first since it's the one an EC may not support, and
+ * anything already changed is put back if a later operation fails.
+ */
+static int fw_profile_apply(struct framework_data *data,
+			    enum platform_profile_option profile)
+{
+	struct fw_batch_op ops[EC_FAN_SPEED_ENTRIES + 2] = {};
+	struct fw_profile_saved saved;
+	int idx = fw_profile_index(profile);
+	int duty, kb, limit;
+	u32 n = 0;
+	int ret;
+
+	if (idx < 0)
+		return idx;
+
+	duty = READ_ONCE(profile_fan_duty[idx]);
+	kb = READ_ONCE(profile_kb_brightness[idx]);
+	limit = READ_ONCE(profile_charge_limit[idx]);
+
+	if (limit >= 0) {
+		ops[n].type = FW_BATCH_CHARGE_LIMIT;
+		ops[n++].value = limit;
+	}
+
+	if (kb >= 0) {
+		ops[n].type = FW_BATCH_KB_BRIGHTNESS;
+		ops[n++].value = kb;
+	}
+
+	/* -1 keeps a manual duty cycle or fan curve across profile switches */
+	if (duty >= 0 || duty == FW_PROFILE_FAN_AUTO) {
+		for (u16 i = 0; i < data->fan_count; i++, n++) {
+			ops[n].index = i;
+			if (duty < 0) {
+				ops[n].type = FW_BATCH_FAN_AUTO;
+			} else {
+				ops[n].type = FW_BATCH_FAN_DUTY;
+				ops[n].value = duty;
+			}
+		}
+	}
+
+	if (!n)
+		goto out;
+
+	ret = fw_profile_save(data, ops, n, &saved);
+	if (ret)
+		return ret;
+
+	ret = fw_batch_apply(data, ops, n);
+	if (ret)
+		return ret;
+
+	for (u32 i = 0; i < n; i++) {
+		if (ops[i].result < 0) {
+			fw_profile_restore(data, ops, n, &saved);
+			return ops[i].result;
+		}
+	}
+
+out:
+	WRITE_ONCE(data->profile, profile);
+
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+static int fw_profile_probe(void *drvdata, unsigned long *choices)
+{
+	set_bit(PLATFORM_PROFILE_QUIET, choices);
+	set_bit(PLATFORM_PROFILE_BALANCED, choices);
+	set_bit(PLATFORM_PROFILE_PERFORMANCE, choices);
+
+	return 0;
+}
+
+static int fw_profile_get(struct device *dev,
+			  enum platform_profile_option *profile)
+{
+	struct framework_data *data = dev_get_drvdata(dev);
+
+	*profile = READ_ONCE(data->profile);
+
+	return 0;
+}
+
+static int fw_profile_set(struct device *dev,
+			  enum platform_profile_option profile)
+{
+	return fw_profile_apply(dev_get_drvdata(dev), profile);
+}
+
+static const struct platform_profile_ops fw_profile_ops = {
+	.probe = fw_profile_probe,
+	.profile_get = fw_profile_get,
+	.profile_set = fw_profile_set,
+};
+
+int fw_profile_register(struct framework_data *data)
+{
+	struct device *ppdev;
+
+	data->profile = PLATFORM_PROFILE_BALANCED;
+
+	/* Not devm, it has to go before the EC does */
+	ppdev = platform_profile_register(&data->pdev->dev, DRV_NAME, data,
+					  &fw_profile_ops);
+	if (IS_ERR(ppdev))
+		return PTR_ERR(ppdev);
+
+	data->profile_dev = ppdev;
+
+	return 0;
+}
+
+void fw_profile_unregister(struct framework_data *data)
+{
+	if (data->profile_dev)
+		platform_profile_remove(data->profile_dev);
+}
+#else
+static int fw_profile_get(struct platform_profile_handler *pprof,
+			  enum platform_profile_option *profile)
+{
+	struct framework_data *data =
+		container_of(pprof, struct framework_data, profile_handler);
+
+	*profile = READ_ONCE(data->profile);
+
+	return 0;
+}
+
+static int fw_profile_set(struct platform_profile_handler *pprof,
+			  enum platform_profile_option profile)
+{
+	struct framework_data *data =
+		container_of(pprof, struct framework_data, profile_handler);
+
+	return fw_profile_apply(data, profile);
+}
+
+/* Only one handler can be registered on these kernels */
+int fw_profile_register(struct framework_data *data)
+{
+	struct platform_profile_handler *pprof = &data->profile_handler;
+	int ret;
+
+	data->profile = PLATFORM_PROFILE_BALANCED;
+
+	set_bit(PLATFORM_PROFILE_QUIET, pprof->choices);
+	set_bit(PLATFORM_PROFILE_BALANCED, pprof->choices);
+	set_bit(PLATFORM_PROFILE_PERFORMANCE, pprof->choices);
+	pprof->profile_get = fw_profile_get;
+	pprof->profile_set = fw_profile_set;
+
+	ret = platform_profile_register(pprof);
+	if (ret)
+		return ret;
+
+	data->profile_registered = true;
+
+	return 0;
+}
+
+void fw_profile_unregister(struct framework_data *data)
+{
+	if (data->profile_registered)
+		platform_profile_remove();
+}
+#endif
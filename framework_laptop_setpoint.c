@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/debugfs.h>
+#include <linux/jiffies.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+
+static unsigned int setpoint_ms;
+module_param(setpoint_ms, uint, 0644);
+MODULE_PARM_DESC(setpoint_ms,
+		 "Send fan and indicator LED writes in the background, at most once per this many ms (0 = off)");
+
+/* Bits in pending, one per fan and then the indicator LED */
+#define FW_SETPOINT_LED EC_FAN_SPEED_ENTRIES
+
+/* Must be called with the setpoint lock held */
+static void fw_setpoint_queue(struct fw_setpoints *sp, unsigned int bit)
+{
+	unsigned long next = sp->last + msecs_to_jiffies(setpoint_ms);
+
+	/* Only the newest value matters, an older one never reaches the EC */
+	if (__test_and_set_bit(bit, &sp->pending))
+		sp->merged++;
+
+	/* Doesn't move the work if it's already queued */
+	queue_delayed_work(system_wq, &sp->work,
+			   time_after(next, jiffies) ? next - jiffies : 0);
+}
+
+/* Queue a pwmN or fanN_target write, false if it has to be sent now */
+bool fw_setpoint_fan(struct framework_data *data, u8 idx,
+		     enum fw_setpoint_kind kind, u32 value)
+{
+	struct fw_setpoints *sp = &data->setpoints;
+
+	if (!setpoint_ms)
+		return false;
+
+	/* Stop a fan curve from fighting the queued value */
+	mutex_lock(&data->fan_lock);
+	data->fan_curve[idx].mode = FW_FAN_MODE_MANUAL;
+	mutex_unlock(&data->fan_lock);
+
+	spin_lock(&sp->lock);
+	sp->fan_kind[idx] = kind;
+	sp->fan_value[idx] = value;
+	fw_setpoint_queue(sp, idx);
+	spin_unlock(&sp->lock);
+
+	return true;
+}
+
+/* Drop a queued fan write, e.g. when it's handed back to the EC */
+void fw_setpoint_fan_cancel(struct framework_data *data, u8 idx)
+{
+	struct fw_setpoints *sp = &data->setpoints;
+
+	spin_lock(&sp->lock);
+	__clear_bit(idx, &sp->pending);
+	spin_unlock(&sp->lock);
+}
+
+/* Drop a queued indicator LED write, e.g. when it's handed back to the EC */
+void fw_setpoint_led_cancel(struct framework_data *data)
+{
+	struct fw_setpoints *sp = &data->setpoints;
+
+	spin_lock(&sp->lock);
+	__clear_bit(FW_SETPOINT_LED, &sp->pending);
+	spin_unlock(&sp->lock);
+}
+
+/* Queue an indicator LED write, false if it has to be sent now */
+bool fw_setpoint_led(struct framework_data *data, const u8 *brightness)
+{
+	struct fw_setpoints *sp = &data->setpoints;
+
+	if (!setpoint_ms)
+		return false;
+
+	spin_lock(&sp->lock);
+	memcpy(sp->led, brightness, sizeof(sp->led));
+	fw_setpoint_queue(sp, FW_SETPOINT_LED);
+	spin_unlock(&sp->lock);
+
+	return true;
+}
+
+static void fw_setpoint_work(struct work_struct *work)
+{
+	struct fw_setpoints *sp =
+		container_of(to_delayed_work(work), struct fw_setpoints, work);
+	struct framework_data *data =
+		container_of(sp, struct framework_data, setpoints);
+	u8 fan_kind[EC_FAN_SPEED_ENTRIES];
+	u32 fan_value[EC_FAN_SPEED_ENTRIES];
+	u8 led[EC_LED_COLOR_COUNT];
+	unsigned long pending;
+	unsigned int bit;
+	u64 sent = 0;
+	int ret;
+
+	spin_lock(&sp->lock);
+	pending = sp->pending;
+	sp->pending = 0;
+	memcpy(fan_kind, sp->fan_kind, sizeof(fan_kind));
+	memcpy(fan_value, sp->fan_value, sizeof(fan_value));
+	memcpy(led, sp->led, sizeof(led));
+	sp->last = jiffies;
+	spin_unlock(&sp->lock);
+
+	for_each_set_bit(bit, &pending, FW_SETPOINT_LED) {
+		/* Switched to another mode since, don't take it back over */
+		if (READ_ONCE(data->fan_curve[bit].mode) != FW_FAN_MODE_MANUAL)
+			continue;
+
+		if (fan_kind[bit] == FW_SETPOINT_FAN_RPM)
+			ret = fw_fan_set_rpm(data, bit, fan_value[bit]);
+		else
+			ret = fw_fan_set_duty(data, bit, fan_value[bit]);
+		if (ret < 0)
+			dev_warn_ratelimited(&data->pdev->dev,
+					     DRV_NAME ": fan %u write failed.\n",
+					     bit + 1);
+		sent++;
+	}
+
+	if (test_bit(FW_SETPOINT_LED, &pending)) {
+		if (fw_color_led_set(data, led) < 0)
+			dev_warn_ratelimited(&data->pdev->dev,
+					     DRV_NAME ": LED write failed.\n");
+		sent++;
+	}
+
+	spin_lock(&sp->lock);
+	sp->sent += sent;
+	spin_unlock(&sp->lock);
+}
+
+int fw_setpoint_register(struct framework_data *data)
+{
+	struct fw_setpoints *sp = &data->setpoints;
+
+	spin_lock_init(&sp->lock);
+	INIT_DELAYED_WORK(&sp->work, fw_setpoint_work);
+	sp->last = jiffies;
+
+	debugfs_create_u64("setpoints_merged", 0444, data->debugfs,
+			   &sp->merged);
+	debugfs_create_u64("setpoints_sent", 0444, data->debugfs, &sp->sent);
+
+	return 0;
+}
+
+void fw_setpoint_unregister(struct framework_data *data)
+{
+	struct fw_setpoints *sp = &data->setpoints;
+
+	/* Still send whatever was written last */
+	if (cancel_delayed_work_sync(&sp->work))
+		fw_setpoint_work(&sp->work.work);
+}
@@ -21,17 +21,11 @@
 
 #include "framework_laptop.h"
 
-#define EC_CMD_PRIVACY_SWITCHES_CHECK_MODE 0x3E14
-
-struct ec_response_privacy_switches_check {
-	uint8_t microphone;
-	uint8_t camera;
-} __ec_align1;
-
 ssize_t framework_privacy_show(struct device *dev,
 			       struct device_attribute *attr, char *buf)
 {
 	struct framework_data *data;
+	bool microphone, camera;
 	int ret;
 
 	data = platform_get_drvdata(to_platform_device(dev));
@@ -39,17 +33,12 @@ ssize_t framework_privacy_show(struct device *dev,
 	if (!data->ec_device)
 		return -ENODEV;
 
-	struct cros_ec_device *ec = dev_get_drvdata(data->ec_device);
-
-	struct ec_response_privacy_switches_check resp;
-
-	ret = cros_ec_cmd(ec, 0, EC_CMD_PRIVACY_SWITCHES_CHECK_MODE, NULL, 0,
-			  &resp, sizeof(resp));
+	ret = fw_privacy_get(data, &microphone, &camera);
 	if (ret < 0)
 		return -EIO;
 
 	/* Output following dell-privacy's format */
 	return sysfs_emit(buf, "[Microphone] [%s]\n[Camera] [%s]\n",
-			  resp.microphone ? "unmuted" : "muted",
-			  resp.camera ? "unmuted" : "muted");
+			  microphone ? "unmuted" : "muted",
+			  camera ? "unmuted" : "muted");
 }
@@ -0,0 +1,606 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver KUnit tests
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Runs the driver's EC paths against a fake cros_ec_device, which counts
+ * every transaction and can add latency or fail commands on request.
+ */
+
+#include <kunit/device.h>
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/err.h>
+#include <linux/workqueue.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#include "framework_laptop.h"
+
+/* Framework specific commands, these must match the driver */
+#define EC_CMD_CHARGE_LIMIT_CONTROL 0x3E03
+#define EC_CMD_CHASSIS_INTRUSION 0x3E09
+#define EC_CMD_FP_LED_LEVEL_CONTROL 0x3E0E
+#define EC_CMD_CHASSIS_OPEN_CHECK 0x3E0F
+#define EC_CMD_PRIVACY_SWITCHES_CHECK_MODE 0x3E14
+
+#define CHG_LIMIT_SET_LIMIT BIT(1)
+
+struct ec_params_ec_chg_limit_control {
+	uint8_t modes;
+	uint8_t max_percentage;
+	uint8_t min_percentage;
+} __ec_align1;
+
+struct ec_response_chg_limit_control {
+	uint8_t max_percentage;
+	uint8_t min_percentage;
+} __ec_align1;
+
+struct ec_params_chassis_intrusion_control {
+	uint8_t clear_magic;
+	uint8_t clear_chassis_status;
+} __ec_align1;
+
+struct ec_response_chassis_intrusion_control {
+	uint8_t chassis_ever_opened;
+	uint8_t coin_batt_ever_remove;
+	uint8_t total_open_count;
+	uint8_t vtr_open_count;
+} __ec_align1;
+
+struct ec_params_fp_led_control {
+	uint8_t set_led_level;
+	uint8_t get_led_level;
+} __ec_align1;
+
+struct ec_response_fp_led_level {
+	uint8_t level;
+} __ec_align1;
+
+struct ec_response_chassis_open_check {
+	uint8_t status;
+} __ec_align1;
+
+struct ec_response_privacy_switches_check {
+	uint8_t microphone;
+	uint8_t camera;
+} __ec_align1;
+
+/**** Fake EC ****/
+struct fw_test_ec {
+	struct cros_ec_device ec;
+	u8 memmap[EC_MEMMAP_SIZE];
+	u8 charge_limit;
+	u8 led_brightness[EC_LED_COLOR_COUNT];
+	bool led_auto;
+	u32 fan_duty[EC_FAN_SPEED_ENTRIES];
+	u32 fan_target[EC_FAN_SPEED_ENTRIES];
+	bool fan_auto[EC_FAN_SPEED_ENTRIES];
+	u8 kb_percent;
+	u8 fp_level;
+	bool chassis_ever_opened;
+	bool chassis_open;
+	bool microphone;
+	bool camera;
+
+	/* Injected by the tests */
+	unsigned int latency_ms;
+	unsigned int inject_errors;
+	struct completion entered;
+
+	/* Transactions seen */
+	unsigned int xfers;
+	unsigned int readmems;
+};
+
+struct fw_test_ctx {
+	struct framework_data data;
+	struct fw_test_ec fake;
+};
+
+/* Returns the response size, or a negative EC result */
+static int fw_test_handle(struct fw_test_ec *f, struct cros_ec_command *msg)
+{
+	void *data = msg->data;
+
+	switch (msg->command) {
+	case EC_CMD_CHARGE_LIMIT_CONTROL: {
+		struct ec_params_ec_chg_limit_control *p = data;
+		struct ec_response_chg_limit_control *r = data;
+
+		if (p->modes & CHG_LIMIT_SET_LIMIT)
+			f->charge_limit = p->max_percentage;
+
+		r->max_percentage = f->charge_limit;
+		r->min_percentage = 0;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_CHASSIS_INTRUSION: {
+		struct ec_params_chassis_intrusion_control *p = data;
+		struct ec_response_chassis_intrusion_control *r = data;
+
+		if (p->clear_chassis_status)
+			f->chassis_ever_opened = false;
+
+		memset(r, 0, sizeof(*r));
+		r->chassis_ever_opened = f->chassis_ever_opened;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_FP_LED_LEVEL_CONTROL: {
+		struct ec_params_fp_led_control *p = data;
+		struct ec_response_fp_led_level *r = data;
+
+		if (!p->get_led_level)
+			f->fp_level = p->set_led_level;
+
+		r->level = f->fp_level;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_CHASSIS_OPEN_CHECK: {
+		struct ec_response_chassis_open_check *r = data;
+
+		r->status = f->chassis_open;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_PRIVACY_SWITCHES_CHECK_MODE: {
+		struct ec_response_privacy_switches_check *r = data;
+
+		r->microphone = f->microphone;
+		r->camera = f->camera;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_LED_CONTROL: {
+		struct ec_params_led_control *p = data;
+		struct ec_response_led_control *r = data;
+
+		if (p->flags & EC_LED_FLAGS_AUTO) {
+			f->led_auto = true;
+		} else if (!(p->flags & EC_LED_FLAGS_QUERY)) {
+			f->led_auto = false;
+			memcpy(f->led_brightness, p->brightness,
+			       sizeof(f->led_brightness));
+		}
+
+		memset(r->brightness_range, 100, sizeof(r->brightness_range));
+		return sizeof(*r);
+	}
+
+	case EC_CMD_PWM_GET_FAN_TARGET_RPM: {
+		struct ec_response_pwm_get_fan_rpm *r = data;
+
+		r->rpm = f->fan_target[0];
+		return sizeof(*r);
+	}
+
+	case EC_CMD_PWM_SET_FAN_TARGET_RPM: {
+		struct ec_params_pwm_set_fan_target_rpm_v1 *p = data;
+
+		if (msg->version < 1 || p->fan_idx >= EC_FAN_SPEED_ENTRIES)
+			return -EC_RES_INVALID_PARAM;
+
+		f->fan_auto[p->fan_idx] = false;
+		f->fan_target[p->fan_idx] = p->rpm;
+		return 0;
+	}
+
+	case EC_CMD_PWM_SET_FAN_DUTY: {
+		struct ec_params_pwm_set_fan_duty_v1 *p = data;
+
+		if (msg->version < 1 || p->fan_idx >= EC_FAN_SPEED_ENTRIES)
+			return -EC_RES_INVALID_PARAM;
+
+		f->fan_auto[p->fan_idx] = false;
+		f->fan_duty[p->fan_idx] = p->percent;
+		return 0;
+	}
+
+	case EC_CMD_THERMAL_AUTO_FAN_CTRL: {
+		struct ec_params_auto_fan_ctrl_v1 *p = data;
+
+		if (msg->version < 1 || p->fan_idx >= EC_FAN_SPEED_ENTRIES)
+			return -EC_RES_INVALID_PARAM;
+
+		f->fan_auto[p->fan_idx] = true;
+		return 0;
+	}
+
+	case EC_CMD_PWM_SET_KEYBOARD_BACKLIGHT: {
+		struct ec_params_pwm_set_keyboard_backlight *p = data;
+
+		f->kb_percent = p->percent;
+		return 0;
+	}
+
+	default:
+		return -EC_RES_INVALID_COMMAND;
+	}
+}
+
+/* cros_ec_cmd() holds the EC lock around this, so it's never reentered */
+static int fw_test_cmd_xfer(struct cros_ec_device *ec,
+			    struct cros_ec_command *msg)
+{
+	struct fw_test_ec *f = container_of(ec, struct fw_test_ec, ec);
+	int ret;
+
+	f->xfers++;
+	complete(&f->entered);
+
+	if (f->latency_ms)
+		msleep(f->latency_ms);
+
+	if (f->inject_errors) {
+		f->inject_errors--;
+		return -ETIMEDOUT;
+	}
+
+	ret = fw_test_handle(f, msg);
+	if (ret < 0) {
+		msg->result = -ret;
+		return 0;
+	}
+
+	msg->result = EC_RES_SUCCESS;
+	return min_t(int, ret, msg->insize);
+}
+
+static int fw_test_cmd_readmem(struct cros_ec_device *ec, unsigned int offset,
+			       unsigned int bytes, void *dest)
+{
+	struct fw_test_ec *f = container_of(ec, struct fw_test_ec, ec);
+
+	if (!bytes || offset >= EC_MEMMAP_SIZE ||
+	    bytes > EC_MEMMAP_SIZE - offset)
+		return -EINVAL;
+
+	f->readmems++;
+
+	if (f->inject_errors) {
+		f->inject_errors--;
+		return -ETIMEDOUT;
+	}
+
+	memcpy(dest, f->memmap + offset, bytes);
+	return bytes;
+}
+
+/**** Setup ****/
+static int fw_test_init(struct kunit *test)
+{
+	struct framework_data *data;
+	struct cros_ec_device *ec;
+	struct fw_test_ctx *ctx;
+	struct device *dev;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx);
+
+	/* Stands in for the cros-ec-dev parent the driver binds to */
+	dev = kunit_device_register(test, "framework_laptop_test");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dev);
+
+	ec = &ctx->fake.ec;
+	ec->dev = dev;
+	ec->cmd_xfer = fw_test_cmd_xfer;
+	ec->cmd_readmem = fw_test_cmd_readmem;
+	/* Protocol v2 goes through cmd_xfer, and skips probing the EC */
+	ec->proto_version = 2;
+	ec->max_request = EC_PROTO2_MAX_PARAM_SIZE;
+	ec->max_response = EC_PROTO2_MAX_PARAM_SIZE;
+	mutex_init(&ec->lock);
+	init_completion(&ctx->fake.entered);
+	dev_set_drvdata(dev, ec);
+
+	data = &ctx->data;
+	data->ec_device = dev;
+	data->fan_count = 2;
+	data->kb_brightness = -1;
+	mutex_init(&data->fan_lock);
+	mutex_init(&data->kb_lock);
+	/* debugfs ignores an error parent, so no files are created */
+	data->debugfs = ERR_PTR(-ENODEV);
+
+	KUNIT_ASSERT_EQ(test, fw_ec_register(data), 0);
+	KUNIT_ASSERT_EQ(test, fw_setpoint_register(data), 0);
+
+	test->priv = ctx;
+
+	return 0;
+}
+
+static void fw_test_exit(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+
+	/* Only set once init got through */
+	if (!ctx)
+		return;
+
+	fw_setpoint_unregister(&ctx->data);
+	fw_ec_unregister(&ctx->data);
+}
+
+/* How many transactions the EC saw since the last call */
+static unsigned int fw_test_xfers(struct fw_test_ctx *ctx)
+{
+	unsigned int xfers = ctx->fake.xfers;
+
+	ctx->fake.xfers = 0;
+	return xfers;
+}
+
+static unsigned int fw_test_readmems(struct fw_test_ctx *ctx)
+{
+	unsigned int readmems = ctx->fake.readmems;
+
+	ctx->fake.readmems = 0;
+	return readmems;
+}
+
+/**** Battery charge limit ****/
+static void fw_test_charge_limit(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+	struct framework_data *data = &ctx->data;
+
+	KUNIT_EXPECT_EQ(test, fw_battery_set_limit(data, 80), 0);
+	KUNIT_EXPECT_EQ(test, ctx->fake.charge_limit, 80);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+
+	KUNIT_EXPECT_EQ(test, fw_battery_get_limit(data), 80);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+
+	/* Rejected before it gets to the EC */
+	KUNIT_EXPECT_EQ(test, fw_battery_set_limit(data, 101), -EINVAL);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 0);
+}
+
+/**** LEDs ****/
+static void fw_test_color_led(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+	struct framework_data *data = &ctx->data;
+	u8 brightness[EC_LED_COLOR_COUNT] = {
+		[EC_LED_COLOR_RED] = 200,
+		[EC_LED_COLOR_BLUE] = 30,
+	};
+
+	data->batt_led_range[EC_LED_COLOR_RED] = 100;
+	data->batt_led_range[EC_LED_COLOR_BLUE] = 100;
+
+	/* Every color in one command, clamped to what the EC supports */
+	KUNIT_EXPECT_EQ(test, fw_color_led_set(data, brightness), 0);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+	KUNIT_EXPECT_FALSE(test, ctx->fake.led_auto);
+	KUNIT_EXPECT_EQ(test, ctx->fake.led_brightness[EC_LED_COLOR_RED], 100);
+	KUNIT_EXPECT_EQ(test, ctx->fake.led_brightness[EC_LED_COLOR_GREEN], 0);
+	KUNIT_EXPECT_EQ(test, ctx->fake.led_brightness[EC_LED_COLOR_BLUE], 30);
+
+	KUNIT_EXPECT_EQ(test, fw_color_led_auto(data), 0);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+	KUNIT_EXPECT_TRUE(test, ctx->fake.led_auto);
+}
+
+static void fw_test_leds(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+	struct framework_data *data = &ctx->data;
+
+	KUNIT_EXPECT_EQ(test, fw_kb_led_set(data, 50), 0);
+	KUNIT_EXPECT_EQ(test, ctx->fake.kb_percent, 50);
+	KUNIT_EXPECT_EQ(test, data->kb_brightness, 50);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+
+	KUNIT_EXPECT_EQ(test, fw_kb_led_set(data, 101), -EINVAL);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 0);
+
+	/* The EC counts fingerprint LED levels down from the brightest */
+	KUNIT_EXPECT_EQ(test, fw_fp_led_set(data, 2), 0);
+	KUNIT_EXPECT_EQ(test, ctx->fake.fp_level, 0);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+}
+
+/**** Fans ****/
+static void fw_test_fan(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+	struct framework_data *data = &ctx->data;
+	u32 rpm;
+
+	KUNIT_EXPECT_EQ(test, fw_fan_set_duty(data, 1, 40), 0);
+	KUNIT_EXPECT_EQ(test, ctx->fake.fan_duty[1], 40);
+	KUNIT_EXPECT_EQ(test, data->fan_curve[1].mode, FW_FAN_MODE_MANUAL);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+
+	KUNIT_EXPECT_EQ(test, fw_fan_set_duty(data, 1, 101), -EINVAL);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 0);
+
+	KUNIT_EXPECT_EQ(test, fw_fan_set_rpm(data, 0, 3000), 0);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+	KUNIT_EXPECT_EQ(test, fw_fan_get_target(data, &rpm), 0);
+	KUNIT_EXPECT_EQ(test, rpm, 3000);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+
+	KUNIT_EXPECT_EQ(test, fw_fan_set_mode(data, 0, FW_FAN_MODE_EC_AUTO), 0);
+	KUNIT_EXPECT_TRUE(test, ctx->fake.fan_auto[0]);
+	KUNIT_EXPECT_EQ(test, data->fan_curve[0].mode, FW_FAN_MODE_EC_AUTO);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+}
+
+static void fw_test_fan_memmap(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+	struct framework_data *data = &ctx->data;
+	u8 raw[FW_MEMMAP_SNAPSHOT_SIZE];
+	u16 speed = 2500, stalled = EC_FAN_SPEED_STALLED;
+
+	memcpy(ctx->fake.memmap + EC_MEMMAP_FAN, &speed, sizeof(speed));
+	memcpy(ctx->fake.memmap + EC_MEMMAP_FAN + 2, &stalled,
+	       sizeof(stalled));
+
+	/* Every fan from one read */
+	KUNIT_ASSERT_EQ(test, fw_ec_memmap_snapshot(data, raw), 0);
+	KUNIT_EXPECT_EQ(test, fw_test_readmems(ctx), 1);
+	KUNIT_EXPECT_EQ(test, fw_memmap_fan_rpm(raw, 0), 2500);
+	KUNIT_EXPECT_EQ(test, fw_memmap_fan_rpm(raw, 1), 0);
+
+	/* The snapshot also refreshed the cache */
+	KUNIT_EXPECT_EQ(test, fw_ec_readmem(data, EC_MEMMAP_FAN, sizeof(speed),
+					    &speed), (int)sizeof(speed));
+	KUNIT_EXPECT_EQ(test, speed, 2500);
+	KUNIT_EXPECT_EQ(test, fw_test_readmems(ctx), 0);
+
+	/* Until it's invalidated */
+	fw_ec_memmap_invalidate(data);
+	KUNIT_EXPECT_EQ(test, fw_ec_readmem(data, EC_MEMMAP_FAN, sizeof(speed),
+					    &speed), (int)sizeof(speed));
+	KUNIT_EXPECT_EQ(test, fw_test_readmems(ctx), 1);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 0);
+}
+
+/**** Chassis intrusion ****/
+static void fw_test_intrusion(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+	struct framework_data *data = &ctx->data;
+	long val;
+
+	ctx->fake.chassis_ever_opened = true;
+	ctx->fake.chassis_open = false;
+
+	KUNIT_EXPECT_EQ(test, fw_intrusion_get(data, 0, &val), 0);
+	KUNIT_EXPECT_EQ(test, val, 1);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+
+	KUNIT_EXPECT_EQ(test, fw_intrusion_get(data, 1, &val), 0);
+	KUNIT_EXPECT_EQ(test, val, 0);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+}
+
+/**** Privacy switches ****/
+static void fw_test_privacy(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+	struct framework_data *data = &ctx->data;
+	bool microphone, camera;
+
+	ctx->fake.microphone = true;
+	ctx->fake.camera = false;
+
+	KUNIT_EXPECT_EQ(test, fw_privacy_get(data, &microphone, &camera), 0);
+	KUNIT_EXPECT_TRUE(test, microphone);
+	KUNIT_EXPECT_FALSE(test, camera);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+}
+
+/* A second reader shares the first one's transaction */
+struct fw_test_reader {
+	struct work_struct work;
+	struct framework_data *data;
+	bool microphone;
+	bool camera;
+	int ret;
+};
+
+static void fw_test_reader_work(struct work_struct *work)
+{
+	struct fw_test_reader *r =
+		container_of(work, struct fw_test_reader, work);
+
+	r->ret = fw_privacy_get(r->data, &r->microphone, &r->camera);
+}
+
+static void fw_test_privacy_shared(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+	struct framework_data *data = &ctx->data;
+	struct fw_test_reader reader = { .data = data };
+	bool microphone, camera;
+
+	ctx->fake.microphone = true;
+	ctx->fake.camera = true;
+	ctx->fake.latency_ms = 100;
+
+	INIT_WORK_ONSTACK(&reader.work, fw_test_reader_work);
+	queue_work(system_unbound_wq, &reader.work);
+
+	/* The first read is with the EC now */
+	wait_for_completion(&ctx->fake.entered);
+	KUNIT_EXPECT_EQ(test, fw_privacy_get(data, &microphone, &camera), 0);
+
+	flush_work(&reader.work);
+	destroy_work_on_stack(&reader.work);
+
+	KUNIT_EXPECT_EQ(test, reader.ret, 0);
+	KUNIT_EXPECT_TRUE(test, reader.microphone && microphone);
+	KUNIT_EXPECT_TRUE(test, reader.camera && camera);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+	KUNIT_EXPECT_EQ(test, data->ec_flights.shared, 1);
+}
+
+/**** Error injection ****/
+static void fw_test_errors(struct kunit *test)
+{
+	struct fw_test_ctx *ctx = test->priv;
+	struct framework_data *data = &ctx->data;
+	u8 raw[FW_MEMMAP_SNAPSHOT_SIZE];
+	bool microphone, camera;
+
+	/* Failures aren't retried, and count towards the circuit breaker */
+	ctx->fake.inject_errors = 2;
+	KUNIT_EXPECT_EQ(test, fw_battery_get_limit(data), -EIO);
+	KUNIT_EXPECT_EQ(test, fw_privacy_get(data, &microphone, &camera),
+			-EIO);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 2);
+	KUNIT_EXPECT_EQ(test, data->ec_health.failures, 2);
+
+	/* One success closes it again */
+	KUNIT_EXPECT_EQ(test, fw_fp_led_set(data, 0), 0);
+	KUNIT_EXPECT_EQ(test, fw_test_xfers(ctx), 1);
+	KUNIT_EXPECT_EQ(test, data->ec_health.failures, 0);
+
+	/* Memory map reads fail the same way */
+	ctx->fake.inject_errors = 1;
+	KUNIT_EXPECT_EQ(test, fw_ec_memmap_snapshot(data, raw), -ETIMEDOUT);
+	KUNIT_EXPECT_EQ(test, fw_test_readmems(ctx), 1);
+	KUNIT_EXPECT_EQ(test, data->ec_health.failures, 1);
+}
+
+static struct kunit_case fw_test_cases[] = {
+	KUNIT_CASE(fw_test_charge_limit),
+	KUNIT_CASE(fw_test_color_led),
+	KUNIT_CASE(fw_test_leds),
+	KUNIT_CASE(fw_test_fan),
+	KUNIT_CASE(fw_test_fan_memmap),
+	KUNIT_CASE(fw_test_intrusion),
+	KUNIT_CASE(fw_test_privacy),
+	KUNIT_CASE(fw_test_privacy_shared),
+	KUNIT_CASE(fw_test_errors),
+	{}
+};
+
+static struct kunit_suite fw_test_suite = {
+	.name = DRV_NAME,
+	.init = fw_test_init,
+	.exit = fw_test_exit,
+	.test_cases = fw_test_cases,
+};
+
+kunit_test_suite(fw_test_suite);
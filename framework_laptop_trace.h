@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM framework_laptop
+
+#if !defined(_FRAMEWORK_LAPTOP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _FRAMEWORK_LAPTOP_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+TRACE_EVENT(fw_ec_cmd_enter,
+	TP_PROTO(int command, unsigned int version, size_t outsize,
+		 size_t insize, unsigned long caller),
+
+	TP_ARGS(command, version, outsize, insize, caller),
+
+	TP_STRUCT__entry(
+		__field(int, command)
+		__field(unsigned int, version)
+		__field(size_t, outsize)
+		__field(size_t, insize)
+		__field(unsigned long, caller)
+	),
+
+	TP_fast_assign(
+		__entry->command = command;
+		__entry->version = version;
+		__entry->outsize = outsize;
+		__entry->insize = insize;
+		__entry->caller = caller;
+	),
+
+	TP_printk("command=0x%04x version=%u outsize=%zu insize=%zu caller=%pS",
+		  __entry->command, __entry->version, __entry->outsize,
+		  __entry->insize, (void *)__entry->caller)
+);
+
+TRACE_EVENT(fw_ec_cmd_exit,
+	TP_PROTO(int command, unsigned int version, size_t outsize,
+		 size_t insize, int result, u64 duration_ns),
+
+	TP_ARGS(command, version, outsize, insize, result, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(int, command)
+		__field(unsigned int, version)
+		__field(size_t, outsize)
+		__field(size_t, insize)
+		__field(int, result)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->command = command;
+		__entry->version = version;
+		__entry->outsize = outsize;
+		__entry->insize = insize;
+		__entry->result = result;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("command=0x%04x version=%u outsize=%zu insize=%zu result=%d duration_ns=%llu",
+		  __entry->command, __entry->version, __entry->outsize,
+		  __entry->insize, __entry->result, __entry->duration_ns)
+);
+
+TRACE_EVENT(fw_ec_readmem_enter,
+	TP_PROTO(unsigned int offset, unsigned int bytes),
+
+	TP_ARGS(offset, bytes),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, offset)
+		__field(unsigned int, bytes)
+	),
+
+	TP_fast_assign(
+		__entry->offset = offset;
+		__entry->bytes = bytes;
+	),
+
+	TP_printk("offset=0x%02x bytes=%u", __entry->offset, __entry->bytes)
+);
+
+TRACE_EVENT(fw_ec_readmem_exit,
+	TP_PROTO(unsigned int offset, unsigned int bytes, int result,
+		 u64 duration_ns),
+
+	TP_ARGS(offset, bytes, result, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, offset)
+		__field(unsigned int, bytes)
+		__field(int, result)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->offset = offset;
+		__entry->bytes = bytes;
+		__entry->result = result;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("offset=0x%02x bytes=%u result=%d duration_ns=%llu",
+		  __entry->offset, __entry->bytes, __entry->result,
+		  __entry->duration_ns)
+);
+
+#endif /* _FRAMEWORK_LAPTOP_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE framework_laptop_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ * Framework Laptop Platform Driver
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _FRAMEWORK_LAPTOP_UAPI_H
+#define _FRAMEWORK_LAPTOP_UAPI_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**** /dev/framework_laptop ****/
+#define FW_IOC_MAGIC 'F'
+
+/**** Telemetry ring buffer ****/
+/*
+ * mmap() the device from offset 0 to get a struct fw_telemetry_ring,
+ * followed by nr_records records starting at data_offset.
+ *
+ * The driver writes records at head and userspace consumes them at tail,
+ * both are free running counters, the record for a counter is at
+ * (counter % nr_records). Read head with acquire semantics before the
+ * records it covers, and store tail once done with them. When the ring
+ * is full new samples are dropped, and counted in dropped.
+ */
+#define FW_TELEMETRY_VERSION 1
+
+struct fw_telemetry_ring {
+	__u32 version;
+	__u32 record_size;
+	__u32 nr_records;
+	__u32 data_offset;
+	__u64 head;	/* written by the driver */
+	__u64 tail;	/* written by userspace */
+	__u64 dropped;	/* written by the driver */
+};
+
+/* Raw values from the EC memory map, see cros_ec_commands.h */
+struct fw_telemetry_record {
+	__u64 timestamp_ns;	/* CLOCK_MONOTONIC */
+	__u16 fan_rpm[4];	/* 0xffff not present, 0xfffe stalled */
+	__u8 temp[24];		/* Kelvin - 200, 0xfc-0xff are errors */
+	__u32 battery_voltage;	/* mV */
+	__u32 battery_rate;	/* mA */
+	__u32 battery_capacity;	/* mAh remaining */
+	__u8 battery_flags;
+	__u8 reserved[11];
+};
+
+struct fw_telemetry_config {
+	__u32 rate_hz;		/* 1 to 200 */
+	__u32 watermark;	/* wake poll() once this many are unread */
+};
+
+/* Only one file can run the sampler, it stops when that file is closed */
+#define FW_IOC_TELEMETRY_START \
+	_IOW(FW_IOC_MAGIC, 0x01, struct fw_telemetry_config)
+#define FW_IOC_TELEMETRY_STOP _IO(FW_IOC_MAGIC, 0x02)
+
+/**** Batched requests ****/
+/*
+ * Every operation is checked before any is sent to the EC, if one is
+ * invalid the ioctl fails with EINVAL and sets its result. Otherwise
+ * they all run in order and each result is 0 or a negative errno.
+ */
+enum fw_batch_op_type {
+	FW_BATCH_CHARGE_LIMIT = 1,	/* value: 0-100 percent */
+	FW_BATCH_KB_BRIGHTNESS = 2,	/* value: 0-100 percent */
+	FW_BATCH_FP_BRIGHTNESS = 3,	/* value: 0 low, 1 medium, 2 high */
+	FW_BATCH_FAN_DUTY = 4,		/* index: fan, value: 0-100 percent */
+	FW_BATCH_FAN_RPM = 5,		/* index: fan, value: RPM */
+	FW_BATCH_FAN_AUTO = 6,		/* index: fan */
+	FW_BATCH_LED_COLOR = 7,		/* color: see below */
+	FW_BATCH_LED_AUTO = 8,
+};
+
+/*
+ * color[] is indexed by enum ec_led_colors (red, green, blue, yellow,
+ * white, amber), in the EC's brightness range for that color.
+ */
+struct fw_batch_op {
+	__u16 type;
+	__u16 index;
+	__s32 result;	/* written by the driver */
+	union {
+		__u64 value;
+		__u8 color[8];
+	};
+};
+
+#define FW_BATCH_MAX_OPS 64
+
+struct fw_batch {
+	__u32 count;
+	__u32 reserved;
+	__u64 ops;	/* pointer to count struct fw_batch_op */
+};
+
+#define FW_IOC_BATCH _IOWR(FW_IOC_MAGIC, 0x03, struct fw_batch)
+
+#endif /* _FRAMEWORK_LAPTOP_UAPI_H */
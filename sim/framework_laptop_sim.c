@@ -0,0 +1,779 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop EC Simulator
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Registers a fake cros_ec_device behind a "cros-ec-dev-sim" platform
+ * device, which framework_laptop binds to like the real thing. Load it
+ * first, then framework_laptop with force=1 on anything that isn't a
+ * Framework Laptop.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/jiffies.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/platform_device.h>
+#include <linux/platform_data/cros_ec_commands.h>
+#include <linux/platform_data/cros_ec_proto.h>
+
+#define SIM_NAME "framework_laptop_sim"
+/* The driver's device, it holds on to ours while bound */
+#define SIM_DRIVER_NAME "framework_laptop"
+
+/* Framework specific commands, these must match the driver */
+#define EC_CMD_CHARGE_LIMIT_CONTROL 0x3E03
+#define EC_CMD_CHASSIS_INTRUSION 0x3E09
+#define EC_CMD_FP_LED_LEVEL_CONTROL 0x3E0E
+#define EC_CMD_CHASSIS_OPEN_CHECK 0x3E0F
+#define EC_CMD_PRIVACY_SWITCHES_CHECK_MODE 0x3E14
+
+#define CHG_LIMIT_DISABLE BIT(0)
+#define CHG_LIMIT_SET_LIMIT BIT(1)
+#define CHG_LIMIT_GET_LIMIT BIT(3)
+
+struct ec_params_ec_chg_limit_control {
+	uint8_t modes;
+	uint8_t max_percentage;
+	uint8_t min_percentage;
+} __ec_align1;
+
+struct ec_response_chg_limit_control {
+	uint8_t max_percentage;
+	uint8_t min_percentage;
+} __ec_align1;
+
+struct ec_params_chassis_intrusion_control {
+	uint8_t clear_magic;
+	uint8_t clear_chassis_status;
+} __ec_align1;
+
+struct ec_response_chassis_intrusion_control {
+	uint8_t chassis_ever_opened;
+	uint8_t coin_batt_ever_remove;
+	uint8_t total_open_count;
+	uint8_t vtr_open_count;
+} __ec_align1;
+
+struct ec_params_fp_led_control {
+	uint8_t set_led_level;
+	uint8_t get_led_level;
+} __ec_align1;
+
+struct ec_response_fp_led_level {
+	uint8_t level;
+} __ec_align1;
+
+struct ec_response_chassis_open_check {
+	uint8_t status;
+} __ec_align1;
+
+struct ec_response_privacy_switches_check {
+	uint8_t microphone;
+	uint8_t camera;
+} __ec_align1;
+
+/**** Module parameters ****/
+static unsigned int fans = 2;
+module_param(fans, uint, 0444);
+MODULE_PARM_DESC(fans, "Number of fans (0-4)");
+
+static unsigned int load_mw = 15000;
+module_param(load_mw, uint, 0644);
+MODULE_PARM_DESC(load_mw, "Heat put out by the simulated CPU in mW");
+
+static unsigned int ambient_mc = 25000;
+module_param(ambient_mc, uint, 0644);
+MODULE_PARM_DESC(ambient_mc, "Ambient temperature in millidegrees Celsius");
+
+static unsigned int latency_us;
+module_param(latency_us, uint, 0644);
+MODULE_PARM_DESC(latency_us,
+		 "Latency of every command without its own in debugfs, in us");
+
+static unsigned int readmem_latency_us;
+module_param(readmem_latency_us, uint, 0644);
+MODULE_PARM_DESC(readmem_latency_us, "Latency of memory map reads in us");
+
+/**** Thermal model ****/
+#define SIM_TICK_MS 100
+#define SIM_MAX_RPM 6000
+/* How quickly a fan gets to its target, in RPM per tick */
+#define SIM_RPM_SLEW 300
+/* Heat capacity in mJ/K, and conductance to ambient in mW/K */
+#define SIM_HEAT_CAPACITY 20000
+#define SIM_CONDUCTANCE_IDLE 150
+#define SIM_CONDUCTANCE_FAN 1200
+/* The EC's own fan curve, duty goes 0-100% over this range */
+#define SIM_AUTO_TEMP_MIN 40000
+#define SIM_AUTO_TEMP_MAX 80000
+
+#define SIM_TEMP_SENSORS 4
+#define SIM_BATTERY_MAH 3572
+#define SIM_BATTERY_MV 15480
+#define SIM_MS_PER_HOUR 3600000
+
+enum sim_fan_mode {
+	SIM_FAN_AUTO,
+	SIM_FAN_DUTY,
+	SIM_FAN_RPM,
+};
+
+struct sim_fan {
+	enum sim_fan_mode mode;
+	u32 duty;
+	u32 target_rpm;
+	u32 rpm;
+};
+
+/* Commands with their own latency in debugfs */
+static const u16 sim_commands[] = {
+	EC_CMD_CHARGE_LIMIT_CONTROL,
+	EC_CMD_CHASSIS_INTRUSION,
+	EC_CMD_FP_LED_LEVEL_CONTROL,
+	EC_CMD_CHASSIS_OPEN_CHECK,
+	EC_CMD_PRIVACY_SWITCHES_CHECK_MODE,
+	EC_CMD_LED_CONTROL,
+	EC_CMD_PWM_GET_FAN_TARGET_RPM,
+	EC_CMD_PWM_SET_FAN_TARGET_RPM,
+	EC_CMD_PWM_GET_KEYBOARD_BACKLIGHT,
+	EC_CMD_PWM_SET_KEYBOARD_BACKLIGHT,
+	EC_CMD_PWM_SET_FAN_DUTY,
+	EC_CMD_THERMAL_AUTO_FAN_CTRL,
+	EC_CMD_TEMP_SENSOR_GET_INFO,
+};
+
+static const char *const sim_sensor_names[SIM_TEMP_SENSORS] = {
+	"F75303_Local", "F75303_CPU", "F75303_DDR", "Battery",
+};
+
+/* How far above the modelled die temperature each sensor reads */
+static const int sim_sensor_offset_mc[SIM_TEMP_SENSORS] = {
+	-8000, 0, -5000, -15000,
+};
+
+static const u8 sim_led_range[EC_LED_COLOR_COUNT] = {
+	[EC_LED_COLOR_RED] = 100,
+	[EC_LED_COLOR_GREEN] = 100,
+	[EC_LED_COLOR_BLUE] = 100,
+	[EC_LED_COLOR_WHITE] = 100,
+	[EC_LED_COLOR_AMBER] = 100,
+};
+
+struct sim_ec {
+	struct cros_ec_device ec;
+	struct platform_device *pdev;
+	struct platform_device *ec_dev_pdev;
+	struct dentry *debugfs;
+	struct delayed_work tick;
+
+	/* Protects everything below */
+	spinlock_t lock;
+	u8 memmap[EC_MEMMAP_SIZE];
+	struct sim_fan fan[EC_FAN_SPEED_ENTRIES];
+	int temp_mc;
+	u32 battery_mah;
+	/* Drained below a mAh, in mA * ms */
+	u64 battery_drain;
+	bool ac_present;
+	u8 charge_limit;
+	u8 kb_brightness;
+	u8 fp_level;
+	bool led_auto;
+	u8 led_brightness[EC_LED_COLOR_COUNT];
+	bool chassis_open;
+	bool chassis_ever_opened;
+	bool microphone;
+	bool camera;
+
+	/* Set from debugfs */
+	u32 command_latency_us[ARRAY_SIZE(sim_commands)];
+	u32 inject_errors;
+	u64 commands;
+	u64 readmems;
+};
+
+static struct sim_ec *sim;
+
+/* Must be called with the lock held */
+static u32 sim_battery_mv(struct sim_ec *s)
+{
+	return SIM_BATTERY_MV - (SIM_BATTERY_MAH - s->battery_mah) / 4;
+}
+
+/* Must be called with the lock held, on battery the whole load is drawn */
+static u32 sim_discharge_ma(struct sim_ec *s)
+{
+	return div_u64((u64)load_mw * 1000, sim_battery_mv(s));
+}
+
+/* Must be called with the lock held */
+static void sim_update_memmap(struct sim_ec *s)
+{
+	u8 *map = s->memmap;
+	u32 volt, cap, flags;
+	s32 rate;
+
+	for (int i = 0; i < EC_FAN_SPEED_ENTRIES; i++) {
+		u16 rpm = i < fans ? s->fan[i].rpm : EC_FAN_SPEED_NOT_PRESENT;
+
+		memcpy(map + EC_MEMMAP_FAN + 2 * i, &rpm, sizeof(rpm));
+	}
+
+	memset(map + EC_MEMMAP_TEMP_SENSOR, EC_TEMP_SENSOR_NOT_PRESENT,
+	       EC_TEMP_SENSOR_ENTRIES);
+	memset(map + EC_MEMMAP_TEMP_SENSOR_B, EC_TEMP_SENSOR_NOT_PRESENT,
+	       EC_TEMP_SENSOR_B_ENTRIES);
+	for (int i = 0; i < SIM_TEMP_SENSORS; i++) {
+		int kelvin = (s->temp_mc + sim_sensor_offset_mc[i]) / 1000 +
+			     273;
+
+		map[EC_MEMMAP_TEMP_SENSOR + i] =
+			clamp(kelvin - EC_TEMP_SENSOR_OFFSET, 0,
+			      EC_TEMP_SENSOR_MAX_VALUE);
+	}
+
+	cap = s->battery_mah;
+	flags = EC_BATT_FLAG_BATT_PRESENT;
+	if (!s->ac_present) {
+		flags |= EC_BATT_FLAG_DISCHARGING;
+		rate = sim_discharge_ma(s);
+	} else if (cap * 100 < SIM_BATTERY_MAH * s->charge_limit) {
+		flags |= EC_BATT_FLAG_AC_PRESENT | EC_BATT_FLAG_CHARGING;
+		rate = 1500;
+	} else {
+		flags |= EC_BATT_FLAG_AC_PRESENT;
+		rate = 0;
+	}
+	volt = sim_battery_mv(s);
+
+	memcpy(map + EC_MEMMAP_BATT_VOLT, &volt, sizeof(volt));
+	memcpy(map + EC_MEMMAP_BATT_RATE, &rate, sizeof(rate));
+	memcpy(map + EC_MEMMAP_BATT_CAP, &cap, sizeof(cap));
+	map[EC_MEMMAP_BATT_FLAG] = flags;
+}
+
+/* Must be called with the lock held */
+static void sim_fan_step(struct sim_ec *s, struct sim_fan *fan)
+{
+	u32 target;
+
+	switch (fan->mode) {
+	case SIM_FAN_AUTO:
+		target = clamp(s->temp_mc - SIM_AUTO_TEMP_MIN, 0,
+			       SIM_AUTO_TEMP_MAX - SIM_AUTO_TEMP_MIN);
+		target = target * SIM_MAX_RPM /
+			 (SIM_AUTO_TEMP_MAX - SIM_AUTO_TEMP_MIN);
+		break;
+	case SIM_FAN_DUTY:
+		target = fan->duty * SIM_MAX_RPM / 100;
+		break;
+	default:
+		target = min_t(u32, fan->target_rpm, SIM_MAX_RPM);
+		break;
+	}
+
+	if (fan->rpm < target)
+		fan->rpm = min(fan->rpm + SIM_RPM_SLEW, target);
+	else
+		fan->rpm = max_t(int, fan->rpm - SIM_RPM_SLEW, target);
+}
+
+/* Newton's law of cooling, with airflow from the fans */
+static void sim_tick(struct work_struct *work)
+{
+	struct sim_ec *s = container_of(to_delayed_work(work), struct sim_ec,
+					tick);
+	u64 airflow = 0, drained;
+	s64 conductance, heat;
+	u32 rem;
+
+	spin_lock(&s->lock);
+
+	for (int i = 0; i < fans; i++) {
+		sim_fan_step(s, &s->fan[i]);
+		airflow += s->fan[i].rpm;
+	}
+
+	conductance = SIM_CONDUCTANCE_IDLE;
+	if (fans)
+		conductance += div_u64(airflow * SIM_CONDUCTANCE_FAN,
+				       SIM_MAX_RPM * fans);
+
+	/* mW in, minus mW out, over a tick, in mJ */
+	heat = (s64)load_mw -
+	       div_s64(conductance * (s->temp_mc - (int)ambient_mc), 1000);
+	s->temp_mc += div_s64(heat * SIM_TICK_MS, SIM_HEAT_CAPACITY);
+
+	/* Drain at the load on battery, or charge at 1.5A under the limit */
+	if (!s->ac_present) {
+		s->battery_drain += (u64)sim_discharge_ma(s) * SIM_TICK_MS;
+		drained = div_u64_rem(s->battery_drain, SIM_MS_PER_HOUR, &rem);
+		s->battery_mah -= min_t(u64, s->battery_mah, drained);
+		s->battery_drain = rem;
+	} else if (s->battery_mah * 100 < SIM_BATTERY_MAH * s->charge_limit) {
+		s->battery_mah = min_t(u32, s->battery_mah + 1,
+				       SIM_BATTERY_MAH);
+	}
+
+	sim_update_memmap(s);
+
+	spin_unlock(&s->lock);
+
+	schedule_delayed_work(&s->tick, msecs_to_jiffies(SIM_TICK_MS));
+}
+
+/**** Host commands ****/
+static void sim_delay(u32 us)
+{
+	if (us)
+		usleep_range(us, us + us / 8 + 1);
+}
+
+static u32 sim_command_latency(struct sim_ec *s, u16 command)
+{
+	for (int i = 0; i < ARRAY_SIZE(sim_commands); i++) {
+		if (sim_commands[i] == command && s->command_latency_us[i])
+			return READ_ONCE(s->command_latency_us[i]);
+	}
+
+	return READ_ONCE(latency_us);
+}
+
+/* Must be called with the lock held, returns the response size */
+static int sim_handle(struct sim_ec *s, struct cros_ec_command *msg)
+{
+	void *data = msg->data;
+
+	switch (msg->command) {
+	case EC_CMD_CHARGE_LIMIT_CONTROL: {
+		struct ec_params_ec_chg_limit_control *p = data;
+		struct ec_response_chg_limit_control *r = data;
+		u8 modes = p->modes;
+
+		if (modes & CHG_LIMIT_DISABLE)
+			s->charge_limit = 100;
+		if (modes & CHG_LIMIT_SET_LIMIT)
+			s->charge_limit = p->max_percentage ?: 100;
+
+		r->max_percentage = s->charge_limit;
+		r->min_percentage = 0;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_CHASSIS_INTRUSION: {
+		struct ec_params_chassis_intrusion_control *p = data;
+		struct ec_response_chassis_intrusion_control *r = data;
+
+		if (p->clear_chassis_status)
+			s->chassis_ever_opened = false;
+
+		memset(r, 0, sizeof(*r));
+		r->chassis_ever_opened = s->chassis_ever_opened;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_FP_LED_LEVEL_CONTROL: {
+		struct ec_params_fp_led_control *p = data;
+		struct ec_response_fp_led_level *r = data;
+
+		if (!p->get_led_level)
+			s->fp_level = p->set_led_level;
+
+		r->level = s->fp_level;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_CHASSIS_OPEN_CHECK: {
+		struct ec_response_chassis_open_check *r = data;
+
+		r->status = s->chassis_open;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_PRIVACY_SWITCHES_CHECK_MODE: {
+		struct ec_response_privacy_switches_check *r = data;
+
+		r->microphone = s->microphone;
+		r->camera = s->camera;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_LED_CONTROL: {
+		struct ec_params_led_control *p = data;
+		struct ec_response_led_control *r = data;
+		u8 flags = p->flags;
+
+		if (p->led_id != EC_LED_ID_BATTERY_LED)
+			return -EC_RES_INVALID_PARAM;
+
+		if (flags & EC_LED_FLAGS_AUTO) {
+			s->led_auto = true;
+		} else if (!(flags & EC_LED_FLAGS_QUERY)) {
+			s->led_auto = false;
+			for (int i = 0; i < EC_LED_COLOR_COUNT; i++)
+				s->led_brightness[i] = min(p->brightness[i],
+							   sim_led_range[i]);
+		}
+
+		memcpy(r->brightness_range, sim_led_range,
+		       sizeof(r->brightness_range));
+		return sizeof(*r);
+	}
+
+	case EC_CMD_PWM_GET_FAN_TARGET_RPM: {
+		struct ec_response_pwm_get_fan_rpm *r = data;
+
+		r->rpm = fans ? s->fan[0].target_rpm : 0;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_PWM_SET_FAN_TARGET_RPM: {
+		struct ec_params_pwm_set_fan_target_rpm_v1 *p = data;
+
+		if (msg->version < 1 || p->fan_idx >= fans)
+			return -EC_RES_INVALID_PARAM;
+
+		s->fan[p->fan_idx].mode = SIM_FAN_RPM;
+		s->fan[p->fan_idx].target_rpm = p->rpm;
+		return 0;
+	}
+
+	case EC_CMD_PWM_SET_FAN_DUTY: {
+		struct ec_params_pwm_set_fan_duty_v1 *p = data;
+
+		if (msg->version < 1 || p->fan_idx >= fans || p->percent > 100)
+			return -EC_RES_INVALID_PARAM;
+
+		s->fan[p->fan_idx].mode = SIM_FAN_DUTY;
+		s->fan[p->fan_idx].duty = p->percent;
+		return 0;
+	}
+
+	case EC_CMD_THERMAL_AUTO_FAN_CTRL: {
+		struct ec_params_auto_fan_ctrl_v1 *p = data;
+
+		if (msg->version < 1 || p->fan_idx >= fans)
+			return -EC_RES_INVALID_PARAM;
+
+		s->fan[p->fan_idx].mode = SIM_FAN_AUTO;
+		return 0;
+	}
+
+	case EC_CMD_PWM_GET_KEYBOARD_BACKLIGHT: {
+		struct ec_response_pwm_get_keyboard_backlight *r = data;
+
+		r->percent = s->kb_brightness;
+		r->enabled = s->kb_brightness > 0;
+		return sizeof(*r);
+	}
+
+	case EC_CMD_PWM_SET_KEYBOARD_BACKLIGHT: {
+		struct ec_params_pwm_set_keyboard_backlight *p = data;
+
+		if (p->percent > 100)
+			return -EC_RES_INVALID_PARAM;
+
+		s->kb_brightness = p->percent;
+		return 0;
+	}
+
+	case EC_CMD_TEMP_SENSOR_GET_INFO: {
+		struct ec_params_temp_sensor_get_info *p = data;
+		struct ec_response_temp_sensor_get_info *r = data;
+		u8 id = p->id;
+
+		if (id >= SIM_TEMP_SENSORS)
+			return -EC_RES_INVALID_PARAM;
+
+		memset(r, 0, sizeof(*r));
+		strscpy(r->sensor_name, sim_sensor_names[id],
+			sizeof(r->sensor_name));
+		r->sensor_type = TEMP_SENSOR_TYPE_BOARD;
+		return sizeof(*r);
+	}
+
+	default:
+		return -EC_RES_INVALID_COMMAND;
+	}
+}
+
+static int sim_cmd_xfer(struct cros_ec_device *ec, struct cros_ec_command *msg)
+{
+	struct sim_ec *s = container_of(ec, struct sim_ec, ec);
+	int ret;
+
+	sim_delay(sim_command_latency(s, msg->command));
+
+	spin_lock(&s->lock);
+
+	s->commands++;
+
+	/* Pretend the EC went away for a while */
+	if (s->inject_errors) {
+		s->inject_errors--;
+		spin_unlock(&s->lock);
+		return -ETIMEDOUT;
+	}
+
+	ret = sim_handle(s, msg);
+
+	spin_unlock(&s->lock);
+
+	if (ret < 0) {
+		msg->result = -ret;
+		return 0;
+	}
+
+	msg->result = EC_RES_SUCCESS;
+	return min_t(int, ret, msg->insize);
+}
+
+static int sim_cmd_readmem(struct cros_ec_device *ec, unsigned int offset,
+			   unsigned int bytes, void *dest)
+{
+	struct sim_ec *s = container_of(ec, struct sim_ec, ec);
+	int ret;
+
+	if (offset >= EC_MEMMAP_SIZE || bytes > EC_MEMMAP_SIZE - offset)
+		return -EINVAL;
+
+	sim_delay(READ_ONCE(readmem_latency_us));
+
+	spin_lock(&s->lock);
+
+	s->readmems++;
+
+	if (bytes) {
+		memcpy(dest, s->memmap + offset, bytes);
+		ret = bytes;
+	} else {
+		/* Zero bytes means a string, same as the LPC interface */
+		ret = strscpy(dest, s->memmap + offset,
+			      EC_MEMMAP_SIZE - offset);
+		ret = ret < 0 ? EC_MEMMAP_SIZE - offset - 1 : ret;
+	}
+
+	spin_unlock(&s->lock);
+
+	return ret;
+}
+
+/**** debugfs ****/
+static int sim_bool_get(void *data, u64 *val)
+{
+	spin_lock(&sim->lock);
+	*val = *(bool *)data;
+	spin_unlock(&sim->lock);
+
+	return 0;
+}
+
+static int sim_bool_set(void *data, u64 val)
+{
+	spin_lock(&sim->lock);
+	*(bool *)data = !!val;
+	/* Opening the chassis is remembered until the host clears it */
+	if (data == &sim->chassis_open && val)
+		sim->chassis_ever_opened = true;
+	/* The battery flags and rate change straight away */
+	if (data == &sim->ac_present)
+		sim_update_memmap(sim);
+	spin_unlock(&sim->lock);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(sim_bool_fops, sim_bool_get, sim_bool_set, "%llu\n");
+
+static int sim_temp_get(void *data, u64 *val)
+{
+	spin_lock(&sim->lock);
+	*val = sim->temp_mc;
+	spin_unlock(&sim->lock);
+
+	return 0;
+}
+
+static int sim_temp_set(void *data, u64 val)
+{
+	spin_lock(&sim->lock);
+	sim->temp_mc = val;
+	sim_update_memmap(sim);
+	spin_unlock(&sim->lock);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(sim_temp_fops, sim_temp_get, sim_temp_set, "%llu\n");
+
+static void sim_debugfs_init(struct sim_ec *s)
+{
+	struct dentry *latency;
+	char name[8];
+
+	s->debugfs = debugfs_create_dir(SIM_NAME, NULL);
+
+	debugfs_create_file("temp_mc", 0644, s->debugfs, NULL,
+			    &sim_temp_fops);
+	debugfs_create_file("chassis_open", 0644, s->debugfs,
+			    &s->chassis_open, &sim_bool_fops);
+	debugfs_create_file("microphone", 0644, s->debugfs, &s->microphone,
+			    &sim_bool_fops);
+	debugfs_create_file("camera", 0644, s->debugfs, &s->camera,
+			    &sim_bool_fops);
+	debugfs_create_file("ac_present", 0644, s->debugfs, &s->ac_present,
+			    &sim_bool_fops);
+	debugfs_create_u32("inject_errors", 0644, s->debugfs,
+			   &s->inject_errors);
+	debugfs_create_u64("commands", 0444, s->debugfs, &s->commands);
+	debugfs_create_u64("readmems", 0444, s->debugfs, &s->readmems);
+
+	/* One file per command, 0 falls back to the latency_us parameter */
+	latency = debugfs_create_dir("latency_us", s->debugfs);
+	for (int i = 0; i < ARRAY_SIZE(sim_commands); i++) {
+		snprintf(name, sizeof(name), "0x%04x", sim_commands[i]);
+		debugfs_create_u32(name, 0644, latency,
+				   &s->command_latency_us[i]);
+	}
+}
+
+/**** Module ****/
+static void sim_init_state(struct sim_ec *s)
+{
+	u8 *map = s->memmap;
+
+	s->temp_mc = ambient_mc;
+	s->battery_mah = SIM_BATTERY_MAH * 3 / 4;
+	s->ac_present = true;
+	s->charge_limit = 100;
+	s->kb_brightness = 50;
+	s->led_auto = true;
+	s->microphone = true;
+	s->camera = true;
+
+	map[EC_MEMMAP_ID] = 'E';
+	map[EC_MEMMAP_ID + 1] = 'C';
+	map[EC_MEMMAP_ID_VERSION] = 1;
+	map[EC_MEMMAP_THERMAL_VERSION] = 2;
+	map[EC_MEMMAP_BATTERY_VERSION] = 1;
+
+	memcpy(map + EC_MEMMAP_BATT_DCAP, &(u32){ SIM_BATTERY_MAH },
+	       sizeof(u32));
+	memcpy(map + EC_MEMMAP_BATT_DVLT, &(u32){ SIM_BATTERY_MV },
+	       sizeof(u32));
+	memcpy(map + EC_MEMMAP_BATT_LFCC, &(u32){ SIM_BATTERY_MAH },
+	       sizeof(u32));
+	strscpy(map + EC_MEMMAP_BATT_MFGR, "Framework", EC_MEMMAP_TEXT_MAX);
+	strscpy(map + EC_MEMMAP_BATT_MODEL, "Simulated", EC_MEMMAP_TEXT_MAX);
+	strscpy(map + EC_MEMMAP_BATT_SERIAL, "0000", EC_MEMMAP_TEXT_MAX);
+	strscpy(map + EC_MEMMAP_BATT_TYPE, "LION", EC_MEMMAP_TEXT_MAX);
+
+	sim_update_memmap(s);
+}
+
+static int __init framework_laptop_sim_init(void)
+{
+	struct platform_device_info info = {
+		.name = "cros-ec-dev-sim",
+		.id = PLATFORM_DEVID_NONE,
+	};
+	struct cros_ec_device *ec;
+	int ret;
+
+	if (fans > EC_FAN_SPEED_ENTRIES)
+		return -EINVAL;
+
+	sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	if (!sim)
+		return -ENOMEM;
+
+	spin_lock_init(&sim->lock);
+	INIT_DELAYED_WORK(&sim->tick, sim_tick);
+	sim_init_state(sim);
+
+	/* Stands in for the transport device, e.g. cros_ec_lpcs */
+	sim->pdev = platform_device_register_simple(SIM_NAME,
+						    PLATFORM_DEVID_NONE,
+						    NULL, 0);
+	if (IS_ERR(sim->pdev)) {
+		ret = PTR_ERR(sim->pdev);
+		goto free;
+	}
+
+	ec = &sim->ec;
+	ec->dev = &sim->pdev->dev;
+	ec->phys_name = SIM_NAME;
+	ec->cmd_xfer = sim_cmd_xfer;
+	ec->cmd_readmem = sim_cmd_readmem;
+	/* Protocol v2 goes through cmd_xfer, and skips probing the EC */
+	ec->proto_version = 2;
+	ec->max_request = EC_PROTO2_MAX_PARAM_SIZE;
+	ec->max_response = EC_PROTO2_MAX_PARAM_SIZE;
+	ec->max_passthru = 0;
+	mutex_init(&ec->lock);
+	BLOCKING_INIT_NOTIFIER_HEAD(&ec->event_notifier);
+	platform_set_drvdata(sim->pdev, ec);
+
+	/*
+	 * The driver looks for a device named cros-ec-dev* and uses its
+	 * parent, the suffix keeps the real cros-ec-dev driver off it.
+	 */
+	info.parent = &sim->pdev->dev;
+	sim->ec_dev_pdev = platform_device_register_full(&info);
+	if (IS_ERR(sim->ec_dev_pdev)) {
+		ret = PTR_ERR(sim->ec_dev_pdev);
+		goto unregister;
+	}
+
+	sim_debugfs_init(sim);
+	schedule_delayed_work(&sim->tick, msecs_to_jiffies(SIM_TICK_MS));
+
+	return 0;
+
+unregister:
+	platform_device_unregister(sim->pdev);
+free:
+	kfree(sim);
+	return ret;
+}
+
+/*
+ * The driver keeps using our cros_ec_device until it's unbound, and nothing
+ * stops this module going first. Take the EC away from new probes, then
+ * unbind the driver before freeing it.
+ */
+static void __exit framework_laptop_sim_exit(void)
+{
+	struct device *dev;
+
+	cancel_delayed_work_sync(&sim->tick);
+	debugfs_remove_recursive(sim->debugfs);
+	platform_device_unregister(sim->ec_dev_pdev);
+
+	dev = bus_find_device_by_name(&platform_bus_type, NULL,
+				      SIM_DRIVER_NAME);
+	if (dev) {
+		device_release_driver(dev);
+		put_device(dev);
+	}
+
+	platform_device_unregister(sim->pdev);
+	kfree(sim);
+}
+
+module_init(framework_laptop_sim_init);
+module_exit(framework_laptop_sim_exit);
+
+MODULE_DESCRIPTION("Framework Laptop EC Simulator");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,460 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Framework Laptop Platform Driver sysfs benchmark
+ *
+ * Copyright (C) 2022 Dustin L. Howett
+ * Copyright (C) 2024 Stephen Horvath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Runs reader and writer threads over every attribute of the driver for
+ * a while, then prints ops/sec and latency percentiles per attribute as
+ * JSON. Writers write back the value each attribute had at the start,
+ * and everything is restored before exiting, including the trigger of
+ * any LED whose brightness was written.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ATTRS 128
+#define VALUE_SIZE 256
+#define TRIGGERS_SIZE 4096
+
+/* Where the driver puts its attributes, the hwmon directory is globbed */
+static const char *const attr_globs[] = {
+	"/sys/devices/platform/framework_laptop/framework_privacy",
+	"/sys/devices/platform/framework_laptop/hwmon/hwmon*/*",
+	"/sys/class/leds/framework_laptop*/brightness",
+	"/sys/class/leds/framework_laptop*/multi_intensity",
+	"/sys/class/power_supply/BAT1/charge_control_end_threshold",
+};
+
+/* In the hwmon directory, but not the driver's */
+static const char *const attr_skip[] = {
+	"name", "uevent", "power", "subsystem", "device", "*_label",
+};
+
+struct attr {
+	char path[PATH_MAX];
+	char value[VALUE_SIZE];
+	size_t value_len;
+	bool writable;
+	/* Writing an LED's brightness overrides its trigger, or removes it */
+	char trigger[VALUE_SIZE];
+};
+
+/* Latencies in ns, one array per thread and attribute */
+struct samples {
+	uint32_t *ns;
+	size_t count;
+	size_t size;
+	uint64_t errors;
+};
+
+struct worker {
+	pthread_t thread;
+	unsigned int id;
+	bool writer;
+	struct samples *samples;
+};
+
+static struct attr attrs[MAX_ATTRS];
+static unsigned int nr_attrs;
+static unsigned int nr_writable;
+
+static unsigned int readers = 1;
+static unsigned int writers;
+static unsigned int duration = 5;
+static const char *filter;
+
+static volatile bool stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int attr_read(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	len = read(fd, buf, size - 1);
+	if (len < 0)
+		len = -errno;
+	close(fd);
+
+	if (len >= 0)
+		buf[len] = '\0';
+	return len;
+}
+
+static int attr_write(const char *path, const char *buf, size_t len)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+
+	ret = write(fd, buf, len);
+	if (ret < 0)
+		ret = -errno;
+	close(fd);
+
+	return ret < 0 ? ret : 0;
+}
+
+static bool attr_skipped(const char *path)
+{
+	const char *name = strrchr(path, '/') + 1;
+	struct stat st;
+
+	if (stat(path, &st) || !S_ISREG(st.st_mode))
+		return true;
+
+	for (size_t i = 0; i < sizeof(attr_skip) / sizeof(*attr_skip); i++) {
+		if (!fnmatch(attr_skip[i], name, 0))
+			return true;
+	}
+
+	return filter && !strstr(path, filter);
+}
+
+/* The trigger file next to a brightness, with "[name]" for the active one */
+static void led_trigger_path(const char *path, char *buf, size_t size)
+{
+	snprintf(buf, size, "%.*s/trigger",
+		 (int)(strrchr(path, '/') - path), path);
+}
+
+static void led_trigger_save(struct attr *attr)
+{
+	char path[PATH_MAX], triggers[TRIGGERS_SIZE];
+	char *start, *end;
+
+	if (strcmp(strrchr(attr->path, '/') + 1, "brightness"))
+		return;
+
+	led_trigger_path(attr->path, path, sizeof(path));
+	if (attr_read(path, triggers, sizeof(triggers)) < 0)
+		return;
+
+	start = strchr(triggers, '[');
+	end = start ? strchr(start, ']') : NULL;
+	if (!end || !strncmp(start + 1, "none]", 5))
+		return;
+
+	snprintf(attr->trigger, sizeof(attr->trigger), "%.*s",
+		 (int)(end - start - 1), start + 1);
+}
+
+/* Through none, so the trigger is activated again even if it's still set */
+static void led_trigger_restore(const struct attr *attr)
+{
+	char path[PATH_MAX];
+
+	led_trigger_path(attr->path, path, sizeof(path));
+	if (attr_write(path, "none", 4) < 0 ||
+	    attr_write(path, attr->trigger, strlen(attr->trigger)) < 0)
+		fprintf(stderr, "failed to restore %s\n", path);
+}
+
+static void attr_add(const char *path)
+{
+	struct attr *attr = &attrs[nr_attrs];
+	int len;
+
+	if (nr_attrs == MAX_ATTRS || attr_skipped(path))
+		return;
+
+	len = attr_read(path, attr->value, sizeof(attr->value));
+	if (len < 0)
+		return;
+
+	snprintf(attr->path, sizeof(attr->path), "%s", path);
+	attr->value_len = len;
+	attr->trigger[0] = '\0';
+
+	/* Before the write below, which may already remove it */
+	if (writers)
+		led_trigger_save(attr);
+
+	/* Only keep writers on attributes that take their own value back */
+	attr->writable = writers && !access(path, W_OK) &&
+			 !attr_write(path, attr->value, len);
+	nr_writable += attr->writable;
+
+	nr_attrs++;
+}
+
+static void attrs_find(void)
+{
+	for (size_t i = 0; i < sizeof(attr_globs) / sizeof(*attr_globs); i++) {
+		glob_t g;
+
+		if (glob(attr_globs[i], 0, NULL, &g))
+			continue;
+
+		/* Sorted, so pwmN is restored before pwmN_enable */
+		for (size_t j = 0; j < g.gl_pathc; j++)
+			attr_add(g.gl_pathv[j]);
+
+		globfree(&g);
+	}
+}
+
+static void attrs_restore(void)
+{
+	for (unsigned int i = 0; i < nr_attrs; i++) {
+		if (attrs[i].writable &&
+		    attr_write(attrs[i].path, attrs[i].value,
+			       attrs[i].value_len) < 0)
+			fprintf(stderr, "failed to restore %s\n",
+				attrs[i].path);
+	}
+
+	/* After the brightness, which would override them again */
+	for (unsigned int i = 0; i < nr_attrs; i++) {
+		if (attrs[i].trigger[0])
+			led_trigger_restore(&attrs[i]);
+	}
+}
+
+static void sample_add(struct samples *s, uint64_t ns)
+{
+	if (s->count == s->size) {
+		size_t size = s->size ? s->size * 2 : 4096;
+		uint32_t *ns_new = realloc(s->ns, size * sizeof(*s->ns));
+
+		if (!ns_new) {
+			s->errors++;
+			return;
+		}
+		s->ns = ns_new;
+		s->size = size;
+	}
+
+	s->ns[s->count++] = ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+/* Go round every attribute, starting at a different one per thread */
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	char buf[VALUE_SIZE];
+	unsigned int i = w->id;
+
+	if (w->writer && !nr_writable)
+		return NULL;
+
+	while (!stop) {
+		struct attr *attr = &attrs[i++ % nr_attrs];
+		struct samples *s = &w->samples[attr - attrs];
+		uint64_t start;
+		int ret;
+
+		if (w->writer && !attr->writable)
+			continue;
+
+		start = now_ns();
+		if (w->writer)
+			ret = attr_write(attr->path, attr->value,
+					 attr->value_len);
+		else
+			ret = attr_read(attr->path, buf, sizeof(buf));
+
+		if (ret < 0)
+			s->errors++;
+		else
+			sample_add(s, now_ns() - start);
+	}
+
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const struct samples *s, double p)
+{
+	size_t i;
+
+	if (!s->count)
+		return 0;
+
+	i = (size_t)(p * (s->count - 1) + 0.5);
+	return s->ns[i] / 1000.0;
+}
+
+/* Merge every thread's samples for one attribute and operation */
+static void report(struct worker *workers, unsigned int nr_workers,
+		   unsigned int idx, bool writer, double elapsed, bool *first)
+{
+	struct samples all = { 0 };
+
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		struct samples *s = &workers[i].samples[idx];
+
+		if (workers[i].writer != writer)
+			continue;
+
+		all.errors += s->errors;
+		if (!s->count)
+			continue;
+
+		all.ns = realloc(all.ns,
+				 (all.count + s->count) * sizeof(*all.ns));
+		if (!all.ns) {
+			perror("realloc");
+			exit(1);
+		}
+		memcpy(all.ns + all.count, s->ns, s->count * sizeof(*s->ns));
+		all.count += s->count;
+	}
+
+	if (!all.count && !all.errors)
+		return;
+
+	qsort(all.ns, all.count, sizeof(*all.ns), cmp_u32);
+
+	printf("%s\n    {\"attribute\": \"%s\", \"op\": \"%s\", "
+	       "\"ops\": %zu, \"errors\": %llu, \"ops_per_sec\": %.1f, "
+	       "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f}",
+	       *first ? "" : ",", attrs[idx].path, writer ? "write" : "read",
+	       all.count, (unsigned long long)all.errors, all.count / elapsed,
+	       percentile_us(&all, 0.5), percentile_us(&all, 0.99),
+	       percentile_us(&all, 0.999));
+	*first = false;
+
+	free(all.ns);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-r readers] [-w writers] [-d seconds] [-f filter]\n"
+		"\n"
+		"  -r  Reader threads (default 1)\n"
+		"  -w  Writer threads (default 0), these write back the\n"
+		"      value read at the start, which takes fans off the\n"
+		"      EC's control until it's restored at the end\n"
+		"  -d  How long to run for in seconds (default 5)\n"
+		"  -f  Only use attributes with this in their path\n",
+		name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	unsigned int nr_workers;
+	uint64_t start;
+	double elapsed;
+	bool first = true;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:w:d:f:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			readers = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			writers = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	nr_workers = readers + writers;
+	if (!nr_workers || !duration)
+		usage(argv[0]);
+
+	attrs_find();
+	if (!nr_attrs) {
+		fprintf(stderr, "no attributes found, is the driver loaded?\n");
+		return 1;
+	}
+
+	workers = calloc(nr_workers, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		workers[i].id = i;
+		workers[i].writer = i >= readers;
+		workers[i].samples = calloc(nr_attrs, sizeof(struct samples));
+		if (!workers[i].samples) {
+			perror("calloc");
+			return 1;
+		}
+	}
+
+	start = now_ns();
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker_run,
+				   &workers[i])) {
+			fprintf(stderr, "failed to start thread %u\n", i);
+			stop = true;
+			nr_workers = i;
+			break;
+		}
+	}
+
+	sleep(duration);
+	stop = true;
+
+	for (unsigned int i = 0; i < nr_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+	elapsed = (now_ns() - start) / 1e9;
+
+	attrs_restore();
+
+	printf("{\n  \"duration_s\": %.3f,\n  \"readers\": %u,\n"
+	       "  \"writers\": %u,\n  \"results\": [",
+	       elapsed, readers, writers);
+	for (unsigned int i = 0; i < nr_attrs; i++) {
+		report(workers, nr_workers, i, false, elapsed, &first);
+		report(workers, nr_workers, i, true, elapsed, &first);
+	}
+	printf("\n  ]\n}\n");
+
+	return 0;
+}